@@ -0,0 +1,683 @@
+/* Permission to use, copy, modify, and/or distribute this software for
+ * any purpose with or without fee is hereby granted.
+
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL
+ * WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE
+ * FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY
+ * DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE. */
+
+/* bench.c - parsing throughput benchmark on generated corpora
+ *
+ * usage: bench [size in MiB]
+ * prints one tab-separated line per corpus and parser mode after header line */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static size_t allocs = 0;	/* allocations made by library */
+
+/* counting allocation functions */
+static void* count_malloc(size_t size)			{ allocs++; return malloc(size); }
+static void* count_calloc(size_t n, size_t size)	{ allocs++; return calloc(n, size); }
+static void* count_realloc(void* ptr, size_t size)	{ allocs += ptr == NULL; return realloc(ptr, size); }
+
+#define PCO_MALLOC count_malloc
+#define PCO_CALLOC count_calloc
+#define PCO_REALLOC count_realloc
+
+#define PCO_IMPLEMENTATION
+#include "../pco.h"
+
+#define MIN_RUNS 3		/* min timed parses of corpus */
+#define MIN_TIME 0.5		/* min seconds of timed parses */
+#define NEST_DEPTH 1000		/* loop depth in nested bf corpus */
+#define TAGS_DEPTH 6		/* max element depth in tags corpus */
+
+/* growing buffer for corpus */
+struct corpus {
+	char* str;		/* characters */
+	size_t len;		/* used size */
+	size_t size;		/* allocated size */
+};
+
+/* benchmark case */
+struct bench {
+	const char* name;					/* corpus name */
+	void (*generate)(struct corpus* corpus, size_t size);	/* corpus generator */
+	struct pco_parser (*grammar)(struct pco_ctx* ctx);	/* grammar constructor */
+};
+
+static unsigned long long seed;	/* state of random generator */
+
+/* xorshift random generator, same sequence on every run */
+static unsigned long long rnd(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+/* append len bytes from str to corpus */
+static void append(struct corpus* corpus, const char* str, size_t len)
+{
+	if (corpus->len + len + 1 > corpus->size) {
+		corpus->size = (corpus->len + len + 1) * 2;
+
+		if ((corpus->str = realloc(corpus->str, corpus->size)) == NULL)
+			err(EXIT_FAILURE, "realloc");
+	}
+
+	memcpy(corpus->str + corpus->len, str, len);
+	corpus->len += len;
+	corpus->str[corpus->len] = '\0';
+}
+
+/* append character to corpus */
+static void append_char(struct corpus* corpus, char c)
+{
+	append(corpus, &c, 1);
+}
+
+/* bf opcodes without loops */
+static const char bf_ops[] = "+-<>.,";
+
+/* flat bf program: opcodes with shallow loops */
+static void generate_bf_flat(struct corpus* corpus, size_t size)
+{
+	while (corpus->len < size) {
+		unsigned i;
+		unsigned count = rnd() % 64 + 1;
+
+		append_char(corpus, '[');
+
+		for (i = 0; i < count; i++)
+			append_char(corpus, bf_ops[rnd() % 6]);
+
+		append_char(corpus, ']');
+	}
+}
+
+/* bf program of deeply nested loops */
+static void generate_bf_nested(struct corpus* corpus, size_t size)
+{
+	unsigned i;
+
+	while (corpus->len < size) {
+		for (i = 0; i < NEST_DEPTH; i++) {
+			append_char(corpus, '[');
+			append_char(corpus, bf_ops[rnd() % 6]);
+		}
+
+		for (i = 0; i < NEST_DEPTH; i++)
+			append_char(corpus, ']');
+	}
+}
+
+/* comma separated integers */
+static void generate_integers(struct corpus* corpus, size_t size)
+{
+	char buf[32];
+
+	append(corpus, buf, sprintf(buf, "%llu", rnd() % 1000000));
+
+	while (corpus->len < size)
+		append(corpus, buf, sprintf(buf, ", %llu", rnd() % (rnd() % 2 ? 100 : 1000000000)));
+}
+
+/* comma separated floats: short decimals, full precision values and exponents */
+static void generate_floats(struct corpus* corpus, size_t size)
+{
+	char buf[64];
+	const char* sep = "";
+	int len;
+
+	while (corpus->len < size) {
+		switch (rnd() % 4) {
+		case 0:
+		case 1:
+			len = sprintf(buf, "%s%llu.%02llu", sep, rnd() % 10000, rnd() % 100);
+			break;
+
+		case 2:
+			len = sprintf(buf, "%s%.17g", sep, (double) (rnd() % 1000000000000) / 3e6);
+			break;
+
+		default:
+			len = sprintf(buf, "%s-%llue%d", sep, rnd() % 1000, (int) (rnd() % 41) - 20);
+			break;
+		}
+
+		append(corpus, buf, len);
+		sep = ", ";
+	}
+}
+
+/* short words separated by long runs of spaces, tabs and new lines */
+static void generate_whitespace(struct corpus* corpus, size_t size)
+{
+	static const char spaces[] = " \t\n";
+	unsigned i;
+	unsigned count;
+
+	while (corpus->len < size) {
+		for (i = 0, count = rnd() % 32 + 1; i < count; i++)
+			append_char(corpus, spaces[rnd() % 4 % 3]);
+
+		for (i = 0, count = rnd() % 8 + 1; i < count; i++)
+			append_char(corpus, 'a' + rnd() % 26);
+	}
+}
+
+/* keywords for keyword corpus and grammar, longer words go before their prefixes */
+static const char* keywords[] = {
+	"auto", "break", "case", "char", "const", "continue", "default", "double",
+	"do", "else", "enum", "extern", "float", "for", "goto", "if",
+	"int", "long", "register", "return", "short", "signed", "sizeof", "static",
+	"struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while",
+};
+
+#define KEYWORDS_COUNT (sizeof(keywords) / sizeof(keywords[0]))
+
+/* keywords separated by single spaces */
+static void generate_keywords(struct corpus* corpus, size_t size)
+{
+	while (corpus->len < size) {
+		const char* word = keywords[rnd() % KEYWORDS_COUNT];
+
+		append(corpus, word, strlen(word));
+		append_char(corpus, ' ');
+	}
+}
+
+/* tag names for tags corpus and grammar */
+static const char* tag_names[] = { "div", "span", "p", "ul", "li", "a" };
+
+#define TAGS_COUNT (sizeof(tag_names) / sizeof(tag_names[0]))
+
+/* append words separated by single spaces */
+static void generate_text(struct corpus* corpus)
+{
+	unsigned i, j;
+	unsigned words = rnd() % 3 + 1;
+	unsigned count;
+
+	for (i = 0; i < words; i++) {
+		if (i != 0)
+			append_char(corpus, ' ');
+
+		for (j = 0, count = rnd() % 8 + 1; j < count; j++)
+			append_char(corpus, 'a' + rnd() % 26);
+	}
+}
+
+/* append element with text and random child elements */
+static void generate_element(struct corpus* corpus, unsigned depth)
+{
+	const char* name = tag_names[rnd() % TAGS_COUNT];
+	unsigned count   = depth < TAGS_DEPTH ? rnd() % 4 : 0;
+	unsigned i;
+
+	append_char(corpus, '<');
+	append(corpus, name, strlen(name));
+	append_char(corpus, '>');
+	generate_text(corpus);
+
+	for (i = 0; i < count; i++) {
+		generate_element(corpus, depth + 1);
+		generate_text(corpus);
+	}
+
+	append(corpus, "</", 2);
+	append(corpus, name, strlen(name));
+	append_char(corpus, '>');
+}
+
+/* nested markup elements with text */
+static void generate_tags(struct corpus* corpus, size_t size)
+{
+	while (corpus->len < size)
+		generate_element(corpus, 0);
+}
+
+static struct pco_parser bf_parser;	/* recursive bf grammar */
+
+/* bf grammar without maps */
+static struct pco_parser grammar_bf(struct pco_ctx* ctx)
+{
+	bf_parser = pco_repeat(ctx, pco_branch(ctx, (struct pco_branch) {
+		.count   = 7,
+		.parsers = {
+			pco_char(ctx, '+'),
+			pco_char(ctx, '-'),
+			pco_char(ctx, '<'),
+			pco_char(ctx, '>'),
+			pco_char(ctx, '.'),
+			pco_char(ctx, ','),
+			pco_sequence(ctx, (struct pco_branch) {
+				.count   = 3,
+				.parsers = {
+					pco_char(ctx, '['),
+					pco_ptr(ctx, &bf_parser),
+					pco_char(ctx, ']'),
+				},
+			}),
+		},
+	}));
+
+	return bf_parser;
+}
+
+/* bf grammar without maps, results are folded instead of collected */
+static struct pco_parser grammar_bf_fold(struct pco_ctx* ctx)
+{
+	bf_parser = pco_fold(ctx, pco_branch(ctx, (struct pco_branch) {
+		.count   = 7,
+		.parsers = {
+			pco_char(ctx, '+'),
+			pco_char(ctx, '-'),
+			pco_char(ctx, '<'),
+			pco_char(ctx, '>'),
+			pco_char(ctx, '.'),
+			pco_char(ctx, ','),
+			pco_sequence(ctx, (struct pco_branch) {
+				.count   = 3,
+				.parsers = {
+					pco_char(ctx, '['),
+					pco_ptr(ctx, &bf_parser),
+					pco_char(ctx, ']'),
+				},
+			}),
+		},
+	}), NULL, NULL);
+
+	return bf_parser;
+}
+
+/* comma separated integers grammar */
+static struct pco_parser grammar_integers(struct pco_ctx* ctx)
+{
+	return pco_sequence(ctx, (struct pco_branch) {
+		.count   = 2,
+		.parsers = {
+			pco_integer(ctx),
+			pco_repeat(ctx, pco_sequence(ctx, (struct pco_branch) {
+				.count   = 3,
+				.parsers = {
+					pco_char(ctx, ','),
+					pco_space(ctx),
+					pco_integer(ctx),
+				},
+			})),
+		},
+	});
+}
+
+/* comma separated integers grammar, values are parsed in place */
+static struct pco_parser grammar_integers_int64(struct pco_ctx* ctx)
+{
+	return pco_sequence(ctx, (struct pco_branch) {
+		.count   = 2,
+		.parsers = {
+			pco_int64(ctx, 0),
+			pco_repeat(ctx, pco_sequence(ctx, (struct pco_branch) {
+				.count   = 3,
+				.parsers = {
+					pco_char(ctx, ','),
+					pco_space(ctx),
+					pco_int64(ctx, 0),
+				},
+			})),
+		},
+	});
+}
+
+/* convert number slice with strtod on null terminated copy */
+static void strtod_map(struct pco_ctx* ctx, struct pco_result* result)
+{
+	struct pco_slice* slice = result->data.result;
+	char* copy              = malloc(slice->len + 1);
+
+	memcpy(copy, slice->ptr, slice->len);
+	copy[slice->len]    = '\0';
+	result->data.number = strtod(copy, NULL);
+
+	free(copy);
+}
+
+/* number characters sliced and converted with strtod */
+static struct pco_parser strtod_number(struct pco_ctx* ctx)
+{
+	struct pco_charset number;
+
+	pco_create_charset(&number);
+	pco_charset_add_range(&number, '0', '9');
+	pco_charset_add(&number, '.');
+	pco_charset_add(&number, '-');
+	pco_charset_add(&number, '+');
+	pco_charset_add(&number, 'e');
+	pco_charset_add(&number, 'E');
+
+	return pco_map(ctx, pco_slice(ctx, pco_charset_filter(ctx, &number)), strtod_map);
+}
+
+/* comma separated floats grammar, numbers are copied and converted with strtod */
+static struct pco_parser grammar_floats_strtod(struct pco_ctx* ctx)
+{
+	return pco_sequence(ctx, (struct pco_branch) {
+		.count   = 2,
+		.parsers = {
+			strtod_number(ctx),
+			pco_repeat(ctx, pco_sequence(ctx, (struct pco_branch) {
+				.count   = 3,
+				.parsers = {
+					pco_char(ctx, ','),
+					pco_space(ctx),
+					strtod_number(ctx),
+				},
+			})),
+		},
+	});
+}
+
+/* comma separated floats grammar, numbers are converted in place */
+static struct pco_parser grammar_floats(struct pco_ctx* ctx)
+{
+	return pco_sequence(ctx, (struct pco_branch) {
+		.count   = 2,
+		.parsers = {
+			pco_float(ctx),
+			pco_repeat(ctx, pco_sequence(ctx, (struct pco_branch) {
+				.count   = 3,
+				.parsers = {
+					pco_char(ctx, ','),
+					pco_space(ctx),
+					pco_float(ctx),
+				},
+			})),
+		},
+	});
+}
+
+/* whitespace separated words grammar */
+static struct pco_parser grammar_whitespace(struct pco_ctx* ctx)
+{
+	struct pco_charset letters;
+
+	pco_create_charset(&letters);
+	pco_charset_add_range(&letters, 'a', 'z');
+
+	return pco_repeat(ctx, pco_sequence(ctx, (struct pco_branch) {
+		.count   = 3,
+		.parsers = {
+			pco_manyspace(ctx),
+			pco_charset(ctx, &letters),
+			pco_charset_filter(ctx, &letters),
+		},
+	}));
+}
+
+/* whitespace separated words grammar, spaces are skipped */
+static struct pco_parser grammar_whitespace_skip(struct pco_ctx* ctx)
+{
+	struct pco_charset letters;
+
+	pco_create_charset(&letters);
+	pco_charset_add_range(&letters, 'a', 'z');
+
+	return pco_repeat(ctx, pco_sequence(ctx, (struct pco_branch) {
+		.count   = 3,
+		.parsers = {
+			pco_skip(ctx, pco_manyspace(ctx)),
+			pco_charset(ctx, &letters),
+			pco_charset_filter(ctx, &letters),
+		},
+	}));
+}
+
+/* space separated keywords grammar */
+static struct pco_parser grammar_keywords(struct pco_ctx* ctx)
+{
+	struct pco_parser words[KEYWORDS_COUNT];
+	unsigned i;
+
+	for (i = 0; i < KEYWORDS_COUNT; i++)
+		words[i] = pco_str(ctx, keywords[i]);
+
+	return pco_repeat(ctx, pco_sequence(ctx, (struct pco_branch) {
+		.count   = 2,
+		.parsers = {
+			pco_branch_n(ctx, words, KEYWORDS_COUNT),
+			pco_space(ctx),
+		},
+	}));
+}
+
+/* space separated keywords grammar with pco_keywords */
+static struct pco_parser grammar_keywords_trie(struct pco_ctx* ctx)
+{
+	return pco_repeat(ctx, pco_sequence(ctx, (struct pco_branch) {
+		.count   = 2,
+		.parsers = {
+			pco_keywords(ctx, keywords, KEYWORDS_COUNT),
+			pco_space(ctx),
+		},
+	}));
+}
+
+static struct pco_parser tag_name;	/* tag name rule */
+static struct pco_parser tag_element;	/* recursive element rule */
+
+/* markup validator written rule by rule, pco_optimize flattens name groups,
+ * drops pco_ptr rules and merges literals of closing tag */
+static struct pco_parser grammar_tags_skip(struct pco_ctx* ctx)
+{
+	struct pco_charset letters;
+	struct pco_charset text;
+
+	pco_create_charset(&letters);
+	pco_charset_add_range(&letters, 'a', 'z');
+	text = letters;
+	pco_charset_add(&text, ' ');
+
+	tag_name = pco_branch(ctx, (struct pco_branch) {
+		.count   = 2,
+		.parsers = {
+			pco_branch(ctx, (struct pco_branch) {
+				.count   = 3,
+				.parsers = { pco_str(ctx, "div"), pco_str(ctx, "span"), pco_str(ctx, "p") },
+			}),
+			pco_branch(ctx, (struct pco_branch) {
+				.count   = 3,
+				.parsers = { pco_str(ctx, "ul"), pco_str(ctx, "li"), pco_str(ctx, "a") },
+			}),
+		},
+	});
+
+	tag_element = pco_sequence(ctx, (struct pco_branch) {
+		.count   = 4,
+		.parsers = {
+			pco_sequence(ctx, (struct pco_branch) {
+				.count   = 3,
+				.parsers = { pco_char(ctx, '<'), pco_ptr(ctx, &tag_name), pco_char(ctx, '>') },
+			}),
+			pco_repeat(ctx, pco_branch(ctx, (struct pco_branch) {
+				.count   = 2,
+				.parsers = {
+					pco_ptr(ctx, &tag_element),
+					pco_sequence(ctx, (struct pco_branch) {
+						.count   = 2,
+						.parsers = { pco_charset(ctx, &letters), pco_charset_filter(ctx, &text) },
+					}),
+				},
+			})),
+			pco_sequence(ctx, (struct pco_branch) {
+				.count   = 2,
+				.parsers = { pco_char(ctx, '<'), pco_char(ctx, '/') },
+			}),
+			pco_sequence(ctx, (struct pco_branch) {
+				.count   = 2,
+				.parsers = { pco_ptr(ctx, &tag_name), pco_char(ctx, '>') },
+			}),
+		},
+	});
+
+	return pco_skip(ctx, pco_repeat(ctx, pco_ptr(ctx, &tag_element)));
+}
+
+/* benchmark cases */
+static const struct bench benches[] = {
+	{ "bf_flat",	generate_bf_flat,	grammar_bf },
+	{ "bf_nested",	generate_bf_nested,	grammar_bf },
+	{ "bf_fold",	generate_bf_flat,	grammar_bf_fold },
+	{ "integers",	generate_integers,	grammar_integers },
+	{ "integers_int64", generate_integers,	grammar_integers_int64 },
+	{ "floats_strtod", generate_floats,	grammar_floats_strtod },
+	{ "floats",	generate_floats,	grammar_floats },
+	{ "whitespace",	generate_whitespace,	grammar_whitespace },
+	{ "whitespace_skip", generate_whitespace, grammar_whitespace_skip },
+	{ "keywords",	generate_keywords,	grammar_keywords },
+	{ "keywords_trie", generate_keywords,	grammar_keywords_trie },
+	{ "tags_skip",	generate_tags,		grammar_tags_skip },
+};
+
+/* monotonic time in seconds */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* parser modes */
+enum mode {
+	MODE_TREE,		/* parser as built */
+	MODE_OPTIMIZED,		/* parser after pco_optimize */
+	MODE_COMPILED,		/* parser after pco_compile */
+	MODE_COUNT,
+};
+
+/* names of parser modes in output */
+static const char* const mode_names[MODE_COUNT] = {
+	[MODE_TREE]      = "tree",
+	[MODE_OPTIMIZED] = "optimized",
+	[MODE_COMPILED]  = "compiled",
+};
+
+/* parse whole corpus in session, aborts case if parser fails or stops before end */
+static void parse(const struct bench* bench, struct pco_ctx* session, const struct pco_parser* parser,
+		const struct corpus* corpus)
+{
+	struct pco_result result = pco_run_parser_n(session, parser, corpus->str, corpus->len);
+
+	if (result.status != PCO_OK || result.rest != corpus->str + corpus->len)
+		errx(EXIT_FAILURE, "%s: parse failed with status %d at %zu", bench->name, result.status,
+				(size_t) (result.rest - corpus->str));
+}
+
+/* run benchmark case with parser in mode and print its line */
+static void run(const struct bench* bench, enum mode mode, size_t size)
+{
+	struct corpus corpus = { NULL, 0, 0 };
+	struct pco_parser parser;
+	struct pco_ctx grammar;
+	struct pco_ctx session;
+	struct rusage usage;
+	size_t first_allocs;
+	unsigned runs;
+	double start;
+	double time;
+
+	seed = 88172645463325252ull;
+	bench->generate(&corpus, size);
+
+	pco_create_ctx(&grammar);
+	parser = bench->grammar(&grammar);
+
+	if (mode == MODE_OPTIMIZED)
+		parser = pco_optimize(&grammar, parser);
+	else if (mode == MODE_COMPILED)
+		parser = pco_compile(&grammar, parser);
+
+	/* first parse, allocates arena chunks */
+	pco_create_ctx(&session);
+
+	allocs = 0;
+	parse(bench, &session, &parser, &corpus);
+
+	first_allocs = allocs;
+
+	/* timed parses, reuse session memory */
+	allocs = 0;
+	start  = now();
+
+	for (runs = 0; runs < MIN_RUNS || now() - start < MIN_TIME; runs++) {
+		pco_reset_ctx(&session);
+		parse(bench, &session, &parser, &corpus);
+	}
+
+	time = now() - start;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("%s\t%s\t%zu\t%u\t%.2f\t%.3f\t%zu\t%.1f\t%ld\n", bench->name, mode_names[mode],
+			corpus.len, runs, corpus.len * (double) runs / time / 1e6, time * 1e9 / (corpus.len * (double) runs),
+			first_allocs, allocs / (double) runs, usage.ru_maxrss);
+
+	pco_free_ctx(&session);
+	pco_free_ctx(&grammar);
+	free(corpus.str);
+}
+
+/* main function */
+int main(int argc, char* argv[])
+{
+	size_t size = 4;	/* corpus size in MiB */
+	unsigned i;
+	enum mode mode;
+	int status;
+
+	if (argc > 2)
+		errx(EXIT_FAILURE, "invalid argument format");
+
+	if (argc == 2 && (size = strtoul(argv[1], NULL, 10)) == 0)
+		errx(EXIT_FAILURE, "invalid corpus size");
+
+	size <<= 20;
+
+	printf("corpus\tmode\tbytes\truns\tmb_s\tns_byte\tallocs_first\tallocs_parse\tpeak_rss_kb\n");
+	fflush(stdout);
+
+	/* every case in own process, so peak rss is not shared */
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		for (mode = 0; mode < MODE_COUNT; mode++) {
+			pid_t pid = fork();
+
+			if (pid < 0)
+				err(EXIT_FAILURE, "fork");
+
+			if (pid == 0) {
+				run(&benches[i], mode, size);
+				fflush(stdout);
+				_exit(EXIT_SUCCESS);
+			}
+
+			if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+				errx(EXIT_FAILURE, "%s failed", benches[i].name);
+		}
+	}
+
+	return 0;
+}
@@ -13,11 +13,16 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <err.h>
 
 #define PCO_IMPLEMENTATION
 #include "../pco.h"
 
+#ifdef BF_GENERATED
+#include "bf_gen.c"	/* parser written by bf -g */
+#endif
+
 static unsigned level = 0;	/* current loop level */
 
 /* print leveled opcode name */
@@ -54,8 +59,8 @@ int main(int argc, char* argv[])
 	struct pco_ctx ctx;
 	pco_create_ctx(&ctx);		/* create context */
 
-	/* define parser */
-	struct pco_parser bf_parser = pco_repeat(&ctx, pco_branch(&ctx, (struct pco_branch) {
+	/* define parser, opcodes are only run by maps so their results are not kept */
+	struct pco_parser bf_parser = pco_fold(&ctx, pco_branch(&ctx, (struct pco_branch) {
 		.count   = 2,
 		.parsers = {
 			/* normal opcodes */
@@ -81,10 +86,32 @@ int main(int argc, char* argv[])
 				},
 			}),
 		},
-	}));
+	}), NULL, NULL);
+
+	/* print c code of parser */
+	if (!strcmp(input, "-g")) {
+		if (!pco_generate(&ctx, bf_parser, "bf_generated", stdout))
+			errx(EXIT_FAILURE, "can not write parser");
+
+		pco_free_ctx(&ctx);
+
+		return 0;
+	}
+
+	/* pick parser, bytecode is not faster than tree on every grammar so it is opt in */
+#if defined(BF_GENERATED)
+	struct pco_parser parser = pco_generated(&ctx, bf_parser, bf_generated, bf_generated_externs);
+
+	if (parser.parser == NULL)
+		errx(EXIT_FAILURE, "generated parser is out of date, run bf -g again");
+#elif defined(BF_COMPILED)
+	struct pco_parser parser = pco_compile(&ctx, bf_parser);
+#else
+	struct pco_parser parser = bf_parser;
+#endif
 
 	/* execute parser */
-	struct pco_result result = pco_run_parser(&ctx, &bf_parser, input);
+	struct pco_result result = pco_run_parser(&ctx, &parser, input);
 
 	/* check parser result */
 	switch (result.status) {
@@ -98,6 +125,9 @@ int main(int argc, char* argv[])
 	case PCO_END_OF_INPUT:
 		printf("unexepted end of input\n");
 		break;
+
+	default:
+		break;
 	}
 
 	/* free context */
@@ -11,428 +11,5424 @@
 
 /* pco.c - parser combinators library for c */
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <float.h>
+#include <locale.h>
 
+/* unistd.h is not included, it would declare read, write and close in code
+ * that includes implementation */
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <sys/sysinfo.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPAN_X86	/* build simd span kernels */
+#include <immintrin.h>
+#endif
+
+/* implementation defines runtime of generated code */
+#define PCO_GENERATED_RUNTIME
 #include "pco.h"
 
-#define size_alloc(x) malloc(sizeof(x))	/* allocate sizeof(x) bytes */
+/* memory functions, may be defined before including pco.h with PCO_IMPLEMENTATION */
+#ifndef PCO_MALLOC
+#define PCO_MALLOC malloc
+#endif
+#ifndef PCO_CALLOC
+#define PCO_CALLOC calloc
+#endif
+#ifndef PCO_REALLOC
+#define PCO_REALLOC realloc
+#endif
+#ifndef PCO_FREE
+#define PCO_FREE free
+#endif
 
-/* create context */
-void pco_create_ctx(struct pco_ctx* ctx)
-{
-	ctx->parsers_data = NULL;
-	ctx->size         = 0;
-}
+#ifdef PCO_PROFILE
+#define call_parser(ctx, p, str) profile_call(ctx, p, str)		/* apply parser p to str */
+#else
+#define call_parser(ctx, p, str) (p)->parser(ctx, (p)->data, str)	/* apply parser p to str */
+#endif
 
-/* free context */
-void pco_free_ctx(struct pco_ctx* ctx)
-{
-	unsigned i;
+#define size_alloc(arena, x) grammar_alloc(arena, sizeof(x))	/* allocate sizeof(x) bytes for parsers data in arena */
+#define ARR_CAPACITY 8							/* default capacity of repeat results */
+#define PARALLEL_PARTS 4						/* input parts per thread in pco_run_parser_parallel */
+#define PARALLEL_MIN_PART 4096						/* min bytes in one part */
+#define PAGE_SIZE_DEFAULT 4096						/* page size where it can not be asked */
 
-	for (i = 0; i < ctx->size; i++)
-		free(ctx->parsers_data[i]);
+/* arena memory block */
+struct pco_chunk {
+	struct pco_chunk* next;	/* next chunk, kept after reset */
+	size_t size;		/* data size */
+	size_t used;		/* used data size */
 
-	free(ctx->parsers_data);
-}
+	max_align_t data[];
+};
 
-/* add data to ctx */
-static void add_to_ctx(struct pco_ctx* ctx, void* data)
+/* alignment for size bytes allocation */
+static size_t alignment(size_t size)
 {
-	ctx->size++;
-	ctx->parsers_data                = realloc(ctx->parsers_data, ctx->size * sizeof(void*));
-	ctx->parsers_data[ctx->size - 1] = data;
-}
+	size_t align = 1;
 
-/* initialize pco_result_array */
-static void create_arr(struct pco_result_array* arr)
-{
-	arr->results = NULL;
-	arr->size    = 0;
+	while (align < size && align < _Alignof(max_align_t))
+		align <<= 1;
+
+	return align;
 }
 
-/* add data to arr */
-static void add_to_arr(struct pco_result_array* arr, void* data)
+/* initialize arena */
+static void arena_create(struct pco_arena* arena)
 {
-	arr->size++;
-	arr->results                = realloc(arr->results, arr->size * sizeof(void*));
-	arr->results[arr->size - 1] = data;
+	arena->head = NULL;
+	arena->cur  = NULL;
 }
 
-/* parser function for pco_char */
-static struct pco_result char_parser(struct pco_ctx* ctx, char* data, const char* str)
+/* allocate size bytes from arena, returns NULL if new chunk can not be allocated */
+static void* arena_alloc(struct pco_arena* arena, size_t size)
 {
-	struct pco_result result = {
-		.status = PCO_OK,
-		.rest   = str + 1,
-	};
+	struct pco_chunk* chunk = arena->cur;
+	size_t align            = alignment(size);
+	size_t offset           = 0;
 
-	if (*str == '\0') {
-		result.status = PCO_END_OF_INPUT;
+	if (chunk != NULL)
+		offset = (chunk->used + align - 1) & ~(align - 1);
 
-		goto fail;
+	if (chunk != NULL && offset + size <= chunk->size)
+		goto done;
+
+	offset = 0;
+
+	/* reuse chunk left by arena_reset */
+	if (chunk != NULL && chunk->next != NULL && chunk->next->size >= size) {
+		chunk = chunk->next;
+		goto done;
 	}
 
-	if (*str != *data) {
-		result.status         = PCO_UNEXEPTED;
-		result.data.unexepted = *str;
+	size_t chunk_size     = size > PCO_CHUNK_SIZE ? size : PCO_CHUNK_SIZE;
+	struct pco_chunk* new = PCO_MALLOC(sizeof(struct pco_chunk) + chunk_size);
 
-		goto fail;
+	if (new == NULL)
+		return NULL;
+
+	new->size = chunk_size;
+
+	if (chunk == NULL) {
+		new->next   = arena->head;
+		arena->head = new;
+	} else {
+		new->next   = chunk->next;
+		chunk->next = new;
 	}
 
-	char* c            = size_alloc(char);
-	*c                 = *str;
-	result.data.result = c;
+	chunk = new;
 
-	add_to_ctx(ctx, c);
+done:
+	chunk->used = offset + size;
+	arena->cur  = chunk;
 
-fail:
-	return result;
+	return (char*) chunk->data + offset;
 }
 
-/* parse one character, sets result to char* from one character */
-struct pco_parser pco_char(struct pco_ctx* ctx, char c)
+/* resize allocation of old_size bytes at ptr, grows it in place if it is last
+ * allocation in arena, returns NULL and keeps ptr if memory can not be allocated */
+static void* arena_grow(struct pco_arena* arena, void* ptr, size_t old_size, size_t size)
 {
-	char* data = size_alloc(c);
-	*data      = c;
+	struct pco_chunk* chunk = arena->cur;
+	void* new;
 
-	add_to_ctx(ctx, data);
+	if (chunk != NULL && (char*) ptr + old_size == (char*) chunk->data + chunk->used
+			&& chunk->used - old_size + size <= chunk->size) {
+		chunk->used += size - old_size;
 
-	return (struct pco_parser) {
-		.data   = data,
-		.parser = (pco_parser_f) char_parser,
-	};
-}
+		return ptr;
+	}
 
-/* parse \n character */
-struct pco_parser pco_new_line(struct pco_ctx* ctx)
-{
-	return pco_char(ctx, '\n');
+	if ((new = arena_alloc(arena, size)) == NULL)
+		return NULL;
+
+	if (old_size != 0)
+		memcpy(new, ptr, old_size);
+
+	return new;
 }
 
-/* parse \t character */
-struct pco_parser pco_tab(struct pco_ctx* ctx)
+/* allocate size bytes for parsers data, constructors return parsers by value
+ * and can not report failure, so process is aborted when memory ends */
+static void* grammar_alloc(struct pco_arena* arena, size_t size)
 {
-	return pco_char(ctx, '\t');
+	void* ptr = arena_alloc(arena, size);
+
+	if (ptr == NULL) {
+		fprintf(stderr, "pco: can not allocate %zu bytes for parsers data\n", size);
+		abort();
+	}
+
+	return ptr;
 }
 
-/* parse space character */
-struct pco_parser pco_space(struct pco_ctx* ctx)
+/* allocate size bytes for parse results, remembers failure so parse ends with
+ * PCO_NO_MEMORY, returns NULL if memory can not be allocated */
+static void* result_alloc(struct pco_ctx* ctx, size_t size)
 {
-	return pco_char(ctx, ' ');
+	void* ptr = arena_alloc(&ctx->results, size);
+
+	if (ptr == NULL)
+		ctx->no_memory = true;
+
+	return ptr;
 }
 
-/* parse \t, \n or space character */
-struct pco_parser pco_anyspace(struct pco_ctx* ctx)
+/* forget all allocations but keep chunks for reuse */
+static void arena_reset(struct pco_arena* arena)
 {
-	return pco_branch(ctx, (struct pco_branch) {
-				.count = 3,
-				.parsers = {
-					pco_tab(ctx),
-					pco_space(ctx),
-					pco_new_line(ctx),
-				},
-			});
+	arena->cur = arena->head;
+
+	if (arena->cur != NULL)
+		arena->cur->used = 0;
 }
 
-/* parser for pco_str */
-static struct pco_result str_parser(struct pco_ctx* ctx, char* data, const char* str)
+/* position of next allocation in arena */
+static struct pco_mark arena_mark(const struct pco_arena* arena)
 {
-	struct pco_result result = {
-		.status      = PCO_OK,
-		.rest        = str + strlen(data),
-		.data.result = data,
+	return (struct pco_mark) {
+		.chunk = arena->cur,
+		.used  = arena->cur != NULL ? arena->cur->used : 0,
 	};
+}
 
-	if (strlen(str) < strlen(data)) {
-		result.status = PCO_END_OF_INPUT;
+/* forget allocations made after mark but keep chunks for reuse */
+static void arena_rewind(struct pco_arena* arena, struct pco_mark mark)
+{
+	if (mark.chunk == NULL) {
+		arena_reset(arena);
 
-		goto fail;
+		return;
 	}
 
-	if (strncmp(str, data, strlen(data))) {
-		result.status         = PCO_UNEXEPTED;
-		result.data.unexepted = *str;
+	arena->cur       = mark.chunk;
+	mark.chunk->used = mark.used;
+}
+
+/* move used chunks of src to dst, allocations from src stay valid and are freed with dst */
+static void arena_splice(struct pco_arena* dst, struct pco_arena* src)
+{
+	struct pco_chunk* first = src->head;
+	struct pco_chunk* last  = src->cur;
+
+	if (last == NULL)
+		return;
+
+	src->head = last->next;
+	src->cur  = NULL;
+
+	if (dst->cur == NULL) {
+		last->next = dst->head;
+		dst->head  = first;
+	} else {
+		last->next     = dst->cur->next;
+		dst->cur->next = first;
 	}
 
-fail:
-	return result;
+	dst->cur = last;
 }
 
-/* parse string, sets result to char* from excepted string */
-struct pco_parser pco_str(struct pco_ctx* ctx, const char* str)
+/* free all arena chunks */
+static void arena_free(struct pco_arena* arena)
 {
-	char* data = malloc(strlen(str) + 1);
-	strcpy(data, str);
+	struct pco_chunk* chunk;
 
-	add_to_ctx(ctx, data);
+	while ((chunk = arena->head) != NULL) {
+		arena->head = chunk->next;
+		PCO_FREE(chunk);
+	}
 
-	return (struct pco_parser) {
-		.data   = data,
-		.parser = (pco_parser_f) str_parser,
-	};
+	arena->cur = NULL;
 }
 
-/* parser for pco_repeat */
-static struct pco_result repeat_parser(struct pco_ctx* ctx, struct pco_parser* parser, const char* str)
+/* create context */
+void pco_create_ctx(struct pco_ctx* ctx)
 {
-	struct pco_result parser_result;
-	struct pco_result_array arr;
-	const char* rest         = str;
-	struct pco_result result = {
-		.status = PCO_OK,
-	};
+	arena_create(&ctx->grammar);
+	arena_create(&ctx->results);
+	arena_create(&ctx->folds);
 
-	create_arr(&arr);
+	ctx->end     = NULL;
+	ctx->hit_end = false;
+	ctx->discard = 0;
 
-	while ((parser_result = parser->parser(ctx, parser->data, rest)).status == PCO_OK) {
-		rest = parser_result.rest;
+	ctx->fail         = NULL;
+	ctx->expected_end = false;
+	ctx->overflow     = false;
+	ctx->no_memory    = false;
+	pco_create_charset(&ctx->expected);
 
-		add_to_arr(&arr, parser_result.data.result);
-	}
-                     
-	result.data.result                               = size_alloc(struct pco_result_array);
-	*((struct pco_result_array*) result.data.result) = arr;
-	result.rest                                      = rest;
+	ctx->file      = NULL;
+	ctx->file_size = 0;
 
-	add_to_ctx(ctx, arr.results);
-	add_to_ctx(ctx, result.data.result);
+	ctx->memo = (struct pco_memo) {
+		.entries = NULL,
+		.size    = 0,
+		.count   = 0,
+		.limit   = PCO_MEMO_LIMIT,
+		.gen     = 1,
 
-	return result;
+		.log       = NULL,
+		.log_count = 0,
+		.log_size  = 0,
+		.folds     = 0,
+	};
+
+	ctx->profile = (struct pco_profile) {
+		.entries = NULL,
+		.size    = 0,
+		.count   = 0,
+	};
 }
 
-/* apply parser many times while it not throw error */
-struct pco_parser pco_repeat(struct pco_ctx* ctx, struct pco_parser parser)
+/* unmap file mapped by pco_run_parser_file */
+static void file_unmap(struct pco_ctx* ctx)
 {
-	struct pco_parser* data = size_alloc(parser);
-	*data                   = parser;
-
-	add_to_ctx(ctx, data);
+	if (ctx->file != NULL)
+		munmap((void*) ctx->file, ctx->file_size);
 
-	return (struct pco_parser) {
-		.parser = (pco_parser_f) repeat_parser,
-		.data   = data,
-	};
+	ctx->file      = NULL;
+	ctx->file_size = 0;
 }
 
-/* parser for pco_branch */
-static struct pco_result branch_parser(struct pco_ctx* ctx, struct pco_branch* branch, const char* str)
+/* free context */
+void pco_free_ctx(struct pco_ctx* ctx)
 {
-	struct pco_result result;
-	unsigned i;
+	file_unmap(ctx);
+	arena_free(&ctx->grammar);
+	arena_free(&ctx->results);
+	arena_free(&ctx->folds);
 
-	for (i = 0; i < branch->count; i++)
-		if ((result = branch->parsers[i].parser(ctx, branch->parsers[i].data, str)).status == PCO_OK)
-			return result;
+	PCO_FREE(ctx->memo.entries);
+	PCO_FREE(ctx->memo.log);
+	PCO_FREE(ctx->profile.entries);
+}
 
-	return result;
+/* forget all cached results */
+static void memo_clear(struct pco_memo* memo)
+{
+	memo->count = 0;
+	memo->gen++;
 }
 
-/* apply parsers from branch while parser not throw error */
-struct pco_parser pco_branch(struct pco_ctx* ctx, struct pco_branch branch)
+/* free all parse results in context, parsers stay valid */
+void pco_reset_ctx(struct pco_ctx* ctx)
 {
-	struct pco_branch* data = size_alloc(branch);
-	*data                   = branch;
+	arena_reset(&ctx->results);
+	arena_reset(&ctx->folds);
+	memo_clear(&ctx->memo);
+	file_unmap(ctx);
+}
 
-	add_to_ctx(ctx, data);
+/* size of memory page, mprotect fails on unaligned pages if it is wrong */
+static size_t page_size(void)
+{
+#ifdef __linux__
+	return getauxval(AT_PAGESZ);
+#else
+	return PAGE_SIZE_DEFAULT;
+#endif
+}
 
-	return (struct pco_parser) {
-		.parser = (pco_parser_f) branch_parser,
-		.data   = data,
-	};
+/* count of online processors */
+static unsigned cpu_count(void)
+{
+#ifdef __linux__
+	int cpus = get_nprocs();
+
+	return cpus > 0 ? cpus : 1;
+#else
+	return 1;
+#endif
 }
 
-/* filter for digits */
-static bool integer_filter(char c)
+/* change protection of whole pages in arena chunks */
+static void arena_protect(struct pco_arena* arena, int prot)
 {
-	return isdigit(c);
+	size_t page = page_size();
+	struct pco_chunk* chunk;
+	uintptr_t first;
+	uintptr_t last;
+
+	for (chunk = arena->head; chunk != NULL; chunk = chunk->next) {
+		first = ((uintptr_t) chunk->data + page - 1) & ~(page - 1);
+		last  = ((uintptr_t) chunk->data + chunk->size) & ~(page - 1);
+
+		if (first < last)
+			mprotect((void*) first, last - first, prot);
+	}
 }
 
-/* map function for conversion const char* to int in result type */
-static void integer_map(struct pco_ctx* ctx, struct pco_result* result)
+/* move parsers from context to read-only grammar */
+struct pco_grammar* pco_freeze(struct pco_ctx* ctx)
 {
-	int* data = size_alloc(int);
-	*data     = atoi(result->data.result);
+	struct pco_grammar* grammar = PCO_MALLOC(sizeof(struct pco_grammar));
 
-	add_to_ctx(ctx, data);
+	if (grammar == NULL)
+		return NULL;
 
-	result->data.result = data;
+	grammar->arena = ctx->grammar;
+	arena_create(&ctx->grammar);
+
+	arena_protect(&grammar->arena, PROT_READ);
+
+	return grammar;
 }
 
-/* parse integer */
-struct pco_parser pco_integer(struct pco_ctx* ctx)
+/* free grammar, parsers from it become invalid */
+void pco_free_grammar(struct pco_grammar* grammar)
 {
-	return pco_map(ctx, pco_filter(ctx, integer_filter), integer_map);
+	arena_protect(&grammar->arena, PROT_READ | PROT_WRITE);
+	arena_free(&grammar->arena);
+
+	PCO_FREE(grammar);
 }
 
-/* parse \t or space character many times or parse nothing */
-struct pco_parser pco_manyspace(struct pco_ctx* ctx)
+/* data for pco_name */
+struct name_data {
+	struct pco_parser parser;	/* named parser */
+	const char* name;		/* name in profile */
+};
+
+/* parser for pco_name, profile_call applies named parser directly */
+static struct pco_result name_parser(struct pco_ctx* ctx, struct name_data* data, const char* str)
 {
-	return pco_not_empty_repeat(ctx, pco_anyspace(ctx));
+	return data->parser.parser(ctx, data->parser.data, str);
 }
 
-/* parser function for pco_filter */
-static struct pco_result filter_parser(struct pco_ctx* ctx, pco_filter_f filter, const char* str)
+/* give parser name shown by pco_profile_dump, returns parser itself if profiling is disabled */
+struct pco_parser pco_name(struct pco_ctx* ctx, struct pco_parser parser, const char* name)
 {
-	const char* c;
-	unsigned len;
-	struct pco_result result = {
-		.status = PCO_OK,
+#ifdef PCO_PROFILE
+	struct name_data* data = size_alloc(&ctx->grammar, struct name_data);
+	*data                  = (struct name_data) {
+		.parser = parser,
+		.name   = name,
 	};
 
-	for (c = str, len = 0; *c != '\0'; c++)
-		if (filter(*c))
-			len++;
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) name_parser,
+		.data   = data,
+	};
+#else
+	return parser;
+#endif
+}
 
-	result.rest        = str + len;
-	result.data.result = malloc(len + 1);
-	strncpy(result.data.result, str, len);
-	((char*) result.data.result)[len] = '\0';
+#ifdef PCO_PROFILE
+/* monotonic time in nanoseconds */
+static unsigned long long profile_time(void)
+{
+	struct timespec ts;
 
-	add_to_ctx(ctx, result.data.result);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	return result;
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
-/* parse \t or space character many times or parse nothing */
-struct pco_parser pco_filter(struct pco_ctx* ctx, pco_filter_f filter)
+/* hash of parser node */
+static size_t profile_hash(const struct pco_parser* parser)
 {
-	return (struct pco_parser) {
-		.parser = (pco_parser_f) filter_parser,
-		.data   = filter,
-	};
+	uintptr_t hash = (uintptr_t) parser->data * 0x9e3779b97f4a7c15ull ^ (uintptr_t) parser->parser;
+
+	return hash ^ hash >> 29;
 }
 
-/* parser function for pco_sequence */
-static struct pco_result sequence_parser(struct pco_ctx* ctx, struct pco_branch* branch, const char* str)
+/* counters of parser node, adds them to table if not found */
+static struct pco_profile_entry* profile_entry(struct pco_profile* profile, const struct pco_parser* parser)
 {
-	struct pco_result result = {
-		.status      = PCO_OK,
-	}, parser_result;
-	const char* rest = str;
-	struct pco_result_array arr;
-	unsigned i;
+	struct pco_profile_entry* old = profile->entries;
+	size_t old_size               = profile->size;
+	struct pco_profile_entry* entry;
+	size_t i;
 
-	create_arr(&arr);
+	if (profile->count * 2 >= profile->size) {
+		profile->size    = old_size == 0 ? 256 : old_size * 2;
+		profile->entries = PCO_CALLOC(profile->size, sizeof(struct pco_profile_entry));
+		profile->count   = 0;
 
-	for (i = 0; i < branch->count; i++) {
-		if ((parser_result = branch->parsers[i].parser(ctx, branch->parsers[i].data, rest)).status
-				!= PCO_OK)
-			return parser_result;
+		for (i = 0; i < old_size; i++) {
+			if (old[i].parser == NULL)
+				continue;
 
-		rest = parser_result.rest;
-		add_to_arr(&arr, parser_result.data.result);
+			*profile_entry(profile, &(struct pco_parser) { old[i].parser, old[i].data }) = old[i];
+		}
+
+		PCO_FREE(old);
+	}
+
+	for (i = profile_hash(parser) & (profile->size - 1);; i = (i + 1) & (profile->size - 1)) {
+		entry = &profile->entries[i];
+
+		if (entry->parser == parser->parser && entry->data == parser->data)
+			return entry;
+
+		if (entry->parser == NULL)
+			break;
+	}
+
+	entry->parser = parser->parser;
+	entry->data   = parser->data;
+	profile->count++;
+
+	return entry;
+}
+
+/* apply parser to str counting its calls, results and time */
+static struct pco_result profile_call(struct pco_ctx* ctx, const struct pco_parser* parser, const char* str)
+{
+	struct pco_profile_entry* entry;
+	struct pco_result result;
+	unsigned long long start;
+	const char* name = NULL;
+
+	/* named parser is counted as parser itself */
+	if (parser->parser == (pco_parser_f) name_parser) {
+		name   = ((struct name_data*) parser->data)->name;
+		parser = &((struct name_data*) parser->data)->parser;
 	}
 
-	result.data.result                               = size_alloc(struct pco_result_array);
-	*((struct pco_result_array*) result.data.result) = arr;
-	result.rest                                      = rest;
+	entry = profile_entry(&ctx->profile, parser);
+
+	if (name != NULL)
+		entry->name = name;
+
+	entry->calls++;
+	entry->active++;
+	start = profile_time();
+
+	result = parser->parser(ctx, parser->data, str);
 
-	add_to_ctx(ctx, arr.results);
-	add_to_ctx(ctx, result.data.result);
+	/* table may grow while parser runs */
+	entry = profile_entry(&ctx->profile, parser);
+
+	/* time of recursive calls is already counted by outer call */
+	if (--entry->active == 0)
+		entry->time += profile_time() - start;
+
+	if (result.status == PCO_OK) {
+		entry->ok++;
+		entry->bytes += result.rest - str;
+	} else
+		entry->fail++;
 
 	return result;
 }
+#endif
 
-/* apply all parsers from sequence */
-struct pco_parser pco_sequence(struct pco_ctx* ctx, struct pco_branch sequence)
+/* allocate array in ctx with place for capacity elements, returns NULL if results are discarded */
+static struct pco_result_array* create_arr(struct pco_ctx* ctx, unsigned capacity)
 {
-	struct pco_branch* data = size_alloc(sequence);
-	*data                   = sequence;
+	struct pco_result_array* arr;
 
-	add_to_ctx(ctx, data);
+	if (ctx->discard)
+		return NULL;
 
-	return (struct pco_parser) {
-		.parser = (pco_parser_f) sequence_parser,
-		.data   = data,
+	if ((arr = result_alloc(ctx, sizeof(struct pco_result_array) + capacity * sizeof(void*))) == NULL)
+		return NULL;
+
+	*arr = (struct pco_result_array) {
+		.results  = (void**) (arr + 1),
+		.size     = 0,
+		.capacity = capacity,
 	};
+
+	return arr;
 }
 
-/* structure for data in map parser */
-struct map_data {
-	struct pco_parser parser;
-	pco_map_f map;
-};
+/* add data to arr, doubles arr capacity when it is full, data is dropped if
+ * memory ends and parse then ends with PCO_NO_MEMORY */
+static void add_to_arr(struct pco_ctx* ctx, struct pco_result_array* arr, void* data)
+{
+	void** results;
 
-/* parser function for pco_map */
-static struct pco_result map_parser(struct pco_ctx* ctx, struct map_data* map_data, const char* str)
+	if (arr == NULL)
+		return;
+
+	if (arr->size == arr->capacity) {
+		unsigned capacity = arr->capacity == 0 ? ARR_CAPACITY : arr->capacity * 2;
+
+		results = arena_grow(&ctx->results, arr->results, arr->capacity * sizeof(void*),
+				capacity * sizeof(void*));
+
+		if (results == NULL) {
+			ctx->no_memory = true;
+			return;
+		}
+
+		arr->results  = results;
+		arr->capacity = capacity;
+	}
+
+	arr->results[arr->size++] = data;
+}
+
+/* make result from arr */
+static struct pco_result arr_result(struct pco_result_array* arr, const char* rest)
 {
-	struct pco_result result = map_data->parser.parser(ctx, map_data->parser.data, str);
+	return (struct pco_result) {
+		.status      = PCO_OK,
+		.rest        = rest,
+		.data.result = arr,
+	};
+}
 
-	if (result.status != PCO_OK)
-		return result;
+/* result for unexepted input at str */
+static struct pco_result fail_result(const struct pco_ctx* ctx, const char* str)
+{
+	struct pco_result result = {
+		.status = PCO_END_OF_INPUT,
+		.rest   = str,
+	};
 
-	map_data->map(ctx, &result);
+	if (str != ctx->end) {
+		result.status         = PCO_UNEXEPTED;
+		result.data.unexepted = *str;
+	}
 
 	return result;
 }
 
-/* process other parser result */
-struct pco_parser pco_map(struct pco_ctx* ctx, struct pco_parser parser, pco_map_f map)
+/* start tracking failures from pos */
+static void fail_start(struct pco_ctx* ctx, const char* pos)
 {
-	struct map_data* data = size_alloc(struct map_data);
-	*data                 = (struct map_data) {
-		.map    = map,
-		.parser = parser,
-	};
+	ctx->fail         = pos;
+	ctx->expected_end = false;
+	ctx->overflow     = false;
 
-	add_to_ctx(ctx, data);
+	memset(ctx->expected.chars, 0, sizeof(ctx->expected.chars));
+}
 
-	return (struct pco_parser) {
-		.parser = (pco_parser_f) map_parser,
-		.data   = data,
-	};
+/* remember that c was excepted at pos, if no parser failed further */
+static inline void fail_char(struct pco_ctx* ctx, const char* pos, char c)
+{
+	if (pos < ctx->fail)
+		return;
+
+	if (pos > ctx->fail)
+		fail_start(ctx, pos);
+
+	ctx->expected.chars[(unsigned char) c / 8] |= 1 << (unsigned char) c % 8;
 }
 
-/* map function for pco_not_empty_repeat */
-static void not_empty_repeat_map(struct pco_ctx* ctx, struct pco_result* result)
+/* remember that characters from set were excepted at pos, if no parser failed further */
+static void fail_set(struct pco_ctx* ctx, const char* pos, const struct pco_charset* set)
 {
-	struct pco_result_array* arr = result->data.result;
+	unsigned i;
 
-	if (arr->size == 0 && *result->rest == '\0')
-		result->status = PCO_END_OF_INPUT;
-	else if (arr->size == 0) {
-		result->status         = PCO_UNEXEPTED;
-		result->data.unexepted = *result->rest;
-	}
+	if (pos < ctx->fail)
+		return;
+
+	if (pos > ctx->fail)
+		fail_start(ctx, pos);
+
+	for (i = 0; i < sizeof(set->chars); i++)
+		ctx->expected.chars[i] |= set->chars[i];
 }
 
-/* apply parser many times while it not throw error but output should be not empty */
-struct pco_parser pco_not_empty_repeat(struct pco_ctx* ctx, struct pco_parser parser)
+/* remember that characters from first to last were excepted at pos, if no parser failed further */
+static void fail_range(struct pco_ctx* ctx, const char* pos, char first, char last)
 {
-	return pco_map(ctx, pco_repeat(ctx, parser), not_empty_repeat_map);
+	struct pco_charset set;
+
+	if (pos < ctx->fail)
+		return;
+
+	pco_create_charset(&set);
+	pco_charset_add_range(&set, first, last);
+	fail_set(ctx, pos, &set);
 }
 
-/* parser function for pco_ptr */
-static struct pco_result ptr_parser(struct pco_ctx* ctx, struct pco_parser* parser, const char* str)
+/* remember that number at pos does not fit in its type, if no parser failed further */
+static void fail_overflow(struct pco_ctx* ctx, const char* pos)
 {
-	return parser->parser(ctx, parser->data, str);
+	if (pos < ctx->fail)
+		return;
+
+	if (pos > ctx->fail)
+		fail_start(ctx, pos);
+
+	ctx->overflow = true;
 }
 
-/* apply parser from parser (useful in recursive parsers) */
-struct pco_parser pco_ptr(struct pco_ctx* ctx, struct pco_parser* parser)
+/* result of parse which ran out of memory for results at str */
+static struct pco_result no_memory_result(const char* str)
 {
-	return (struct pco_parser) {
-		.parser = (pco_parser_f) ptr_parser,
-		.data   = parser,
+	return (struct pco_result) {
+		.status = PCO_NO_MEMORY,
+		.rest   = str,
 	};
 }
 
-/* run parser on str */
-struct pco_result pco_run_parser(struct pco_ctx* ctx, const struct pco_parser* parser, const char* str)
+/* result for furthest failure */
+static struct pco_result furthest_result(const struct pco_ctx* ctx)
 {
-	struct pco_result result = parser->parser(ctx, parser->data, str);
+	struct pco_result result = fail_result(ctx, ctx->fail);
 
-	if (result.status != PCO_OK)
-		goto fail;
+	if (ctx->overflow)
+		result.status = PCO_OVERFLOW;
 
-	if (*result.rest != '\0') {
-		result.status         = PCO_UNEXEPTED;
-		result.data.unexepted = *result.rest;
-	}
+	return result;
+}
+
+/* parser function for pco_char */
+static inline struct pco_result char_parser(struct pco_ctx* ctx, char* data, const char* str)
+{
+	struct pco_result result = {
+		.status = PCO_OK,
+		.rest   = str + 1,
+	};
+
+	if (str == ctx->end) {
+		result.status = PCO_END_OF_INPUT;
+		ctx->hit_end  = true;
+		fail_char(ctx, str, *data);
+
+		goto fail;
+	}
+
+	if (*str != *data) {
+		result.status         = PCO_UNEXEPTED;
+		result.data.unexepted = *str;
+		fail_char(ctx, str, *data);
+
+		goto fail;
+	}
+
+	if (ctx->discard)
+		goto fail;
+
+	char* c = result_alloc(ctx, sizeof(char));
+
+	if (c != NULL)
+		*c = *str;
+
+	result.data.result = c;
+
+fail:
+	return result;
+}
+
+/* parse one character, sets result to char* from one character */
+struct pco_parser pco_char(struct pco_ctx* ctx, char c)
+{
+	char* data = size_alloc(&ctx->grammar, c);
+	*data      = c;
+
+	return (struct pco_parser) {
+		.data   = data,
+		.parser = (pco_parser_f) char_parser,
+	};
+}
+
+/* parse \n character */
+struct pco_parser pco_new_line(struct pco_ctx* ctx)
+{
+	return pco_char(ctx, '\n');
+}
+
+/* parse \t character */
+struct pco_parser pco_tab(struct pco_ctx* ctx)
+{
+	return pco_char(ctx, '\t');
+}
+
+/* parse space character */
+struct pco_parser pco_space(struct pco_ctx* ctx)
+{
+	return pco_char(ctx, ' ');
+}
+
+/* parse \t, \n or space character, sets result to char* pointing to character in input */
+struct pco_parser pco_anyspace(struct pco_ctx* ctx)
+{
+	struct pco_charset spaces;
+
+	pco_create_charset(&spaces);
+	pco_charset_add(&spaces, '\t');
+	pco_charset_add(&spaces, ' ');
+	pco_charset_add(&spaces, '\n');
+
+	return pco_charset(ctx, &spaces);
+}
+
+/* structure for data in str parser */
+struct str_data {
+	size_t len;	/* string length */
+	char str[];	/* excepted string */
+};
+
+/* remember first character of len bytes at lit not matched by input at str */
+static void str_fail(struct pco_ctx* ctx, const char* lit, size_t len, const char* str)
+{
+	size_t i;
+
+	if (str + len < ctx->fail)
+		return;
+
+	for (i = 0; i < len && str + i != ctx->end && str[i] == lit[i]; i++);
+
+	if (i != len)
+		fail_char(ctx, str + i, lit[i]);
+}
+
+/* parser for pco_str */
+static inline struct pco_result str_parser(struct pco_ctx* ctx, struct str_data* data, const char* str)
+{
+	struct pco_result result = {
+		.status      = PCO_OK,
+		.rest        = str + data->len,
+		.data.result = data->str,
+	};
+
+	if ((size_t) (ctx->end - str) < data->len) {
+		result.status = PCO_END_OF_INPUT;
+		ctx->hit_end  = true;
+
+		goto fail;
+	}
+
+	if (memcmp(str, data->str, data->len)) {
+		result.status         = PCO_UNEXEPTED;
+		result.data.unexepted = *str;
+
+		goto fail;
+	}
+
+	return result;
+
+fail:
+	str_fail(ctx, data->str, data->len, str);
+
+	return result;
+}
+
+/* parse string, sets result to char* from excepted string */
+struct pco_parser pco_str(struct pco_ctx* ctx, const char* str)
+{
+	size_t len            = strlen(str);
+	struct str_data* data = grammar_alloc(&ctx->grammar, sizeof(struct str_data) + len + 1);
+	data->len             = len;
+	memcpy(data->str, str, len + 1);
+
+	return (struct pco_parser) {
+		.data   = data,
+		.parser = (pco_parser_f) str_parser,
+	};
+}
+
+/* node of keywords trie */
+struct keyword_node {
+	unsigned edges;		/* index of first edge in labels and targets */
+	unsigned count;		/* edges count */
+	const char* word;	/* keyword ending at this node or NULL */
+};
+
+/* data for pco_keywords, trie with edges of every node stored together */
+struct keywords_data {
+	unsigned root[256];		/* child of root for every character, 0 if none */
+	struct keyword_node* nodes;	/* nodes, root is first */
+	unsigned char* labels;		/* edge characters, sorted for every node */
+	unsigned* targets;		/* edge target nodes */
+};
+
+/* trie node used while keywords are added */
+struct keyword_build {
+	unsigned child;		/* first child or 0 */
+	unsigned sibling;	/* next child of parent or 0 */
+	unsigned char c;	/* character of edge from parent */
+	const char* word;	/* keyword ending at this node or NULL */
+};
+
+/* find child of node by character c, returns 0 if none */
+static inline unsigned keyword_next(const struct keywords_data* data, const struct keyword_node* node, char c)
+{
+	unsigned i;
+
+	for (i = node->edges; i < node->edges + node->count; i++)
+		if (data->labels[i] == (unsigned char) c)
+			return data->targets[i];
+
+	return 0;
+}
+
+/* parser for pco_keywords, matches longest keyword */
+static struct pco_result keywords_parser(struct pco_ctx* ctx, struct keywords_data* data, const char* str)
+{
+	const struct keyword_node* node = data->nodes;
+	const char* word                = node->word;
+	const char* rest                = str;
+	const char* c                   = str;
+	struct pco_charset expected;
+	unsigned next, i;
+
+	for (;; c++) {
+		if (node->word != NULL) {
+			word = node->word;
+			rest = c;
+		}
+
+		if (c == ctx->end) {
+			ctx->hit_end = true;
+			break;
+		}
+
+		if ((next = node == data->nodes ? data->root[(unsigned char) *c] : keyword_next(data, node, *c)) == 0)
+			break;
+
+		node = &data->nodes[next];
+	}
+
+	if (word != NULL) {
+		return (struct pco_result) {
+			.status      = PCO_OK,
+			.rest        = rest,
+			.data.result = (char*) word,
+		};
+	}
+
+	if (c >= ctx->fail) {
+		pco_create_charset(&expected);
+
+		for (i = 0; i < node->count; i++)
+			pco_charset_add(&expected, data->labels[node->edges + i]);
+
+		fail_set(ctx, c, &expected);
+	}
+
+	return fail_result(ctx, c);
+}
+
+/* parse longest of count words, sets result to char* from matched word */
+struct pco_parser pco_keywords(struct pco_ctx* ctx, const char* const* words, unsigned count)
+{
+	struct keywords_data* data = size_alloc(&ctx->grammar, struct keywords_data);
+	struct keyword_build* build;
+	unsigned size     = 1;
+	unsigned capacity = 64;
+	unsigned edges    = 0;
+	unsigned* order;
+	unsigned i, node, child, head, tail;
+	const char* w;
+
+	build = PCO_CALLOC(capacity, sizeof(struct keyword_build));
+
+	/* build trie with child lists */
+	for (i = 0; i < count; i++) {
+		size_t len = strlen(words[i]);
+		char* word = grammar_alloc(&ctx->grammar, len + 1);
+
+		memcpy(word, words[i], len + 1);
+
+		for (node = 0, w = word; *w != '\0'; w++) {
+			unsigned* link = &build[node].child;
+
+			/* keep children sorted by character */
+			while (*link != 0 && build[*link].c < (unsigned char) *w)
+				link = &build[*link].sibling;
+
+			if (*link != 0 && build[*link].c == (unsigned char) *w) {
+				node = *link;
+				continue;
+			}
+
+			if (size == capacity) {
+				capacity *= 2;
+				build     = PCO_REALLOC(build, capacity * sizeof(struct keyword_build));
+
+				/* find link again, build moved */
+				for (link = &build[node].child; *link != 0 && build[*link].c < (unsigned char) *w;
+						link = &build[*link].sibling);
+			}
+
+			build[size] = (struct keyword_build) {
+				.child   = 0,
+				.sibling = *link,
+				.c       = *w,
+				.word    = NULL,
+			};
+
+			*link = size;
+			node  = size++;
+			edges++;
+		}
+
+		if (build[node].word == NULL)
+			build[node].word = word;
+	}
+
+	/* number nodes in breadth first order and store edges of every node together */
+	order         = PCO_MALLOC(size * sizeof(unsigned));
+	data->nodes   = grammar_alloc(&ctx->grammar, size * sizeof(struct keyword_node));
+	data->labels  = grammar_alloc(&ctx->grammar, edges + 1);
+	data->targets = grammar_alloc(&ctx->grammar, (edges + 1) * sizeof(unsigned));
+
+	memset(data->root, 0, sizeof(data->root));
+
+	order[0] = 0;
+	edges    = 0;
+
+	for (head = 0, tail = 1; head < tail; head++) {
+		node = order[head];
+
+		data->nodes[head] = (struct keyword_node) {
+			.edges = edges,
+			.count = 0,
+			.word  = build[node].word,
+		};
+
+		for (child = build[node].child; child != 0; child = build[child].sibling) {
+			data->labels[edges]    = build[child].c;
+			data->targets[edges++] = tail;
+			data->nodes[head].count++;
+
+			if (head == 0)
+				data->root[build[child].c] = tail;
+
+			order[tail++] = child;
+		}
+	}
+
+	PCO_FREE(order);
+	PCO_FREE(build);
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) keywords_parser,
+		.data   = data,
+	};
+}
+
+/* structure for data in repeat parser */
+struct repeat_data {
+	struct pco_parser parser;	/* repeated parser */
+	unsigned hint;			/* expected repeats count */
+};
+
+/* parser for pco_repeat */
+static struct pco_result repeat_parser(struct pco_ctx* ctx, struct repeat_data* data, const char* str)
+{
+	struct pco_result_array* arr = create_arr(ctx, data->hint);
+	struct pco_result parser_result;
+	const char* rest = str;
+
+	while ((parser_result = call_parser(ctx, &data->parser, rest)).status == PCO_OK) {
+		rest = parser_result.rest;
+
+		add_to_arr(ctx, arr, parser_result.data.result);
+	}
+
+	return arr_result(arr, rest);
+}
+
+/* apply parser many times while it not throw error */
+struct pco_parser pco_repeat(struct pco_ctx* ctx, struct pco_parser parser)
+{
+	return pco_repeat_hint(ctx, parser, 0);
+}
+
+/* apply parser many times while it not throw error, results array is
+ * allocated for hint results at once */
+struct pco_parser pco_repeat_hint(struct pco_ctx* ctx, struct pco_parser parser, unsigned hint)
+{
+	struct repeat_data* data = size_alloc(&ctx->grammar, struct repeat_data);
+	*data                    = (struct repeat_data) {
+		.parser = parser,
+		.hint   = hint,
+	};
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) repeat_parser,
+		.data   = data,
+	};
+}
+
+/* set of characters which parser input can start with */
+struct first_set {
+	unsigned char chars[32];	/* character bitmap */
+	bool empty;			/* parser can succeed without consuming input */
+	bool exact;			/* set is not widened because of unknown parser */
+};
+
+/* alternatives of branch for every input character */
+struct branch_table {
+	unsigned* lists;	/* alternatives count followed by alternatives indexes */
+	unsigned lookup[257];	/* list for every character, last for end of input */
+
+	struct pco_charset expected;	/* characters which can start some alternative */
+};
+
+/* structure for data in branch parser */
+struct branch_data {
+	struct first_set first;		/* first set of whole branch */
+	struct branch_table table;	/* dispatch table */
+
+	unsigned count;			/* alternatives count */
+	struct pco_parser parsers[];	/* alternatives */
+};
+
+#define FIRST_DEPTH 16	/* max pco_ptr and inexact branch depth followed in first set computation */
+
+static void branch_table_create(struct pco_arena* arena, struct branch_table* table, struct first_set* first,
+		const struct pco_parser* parsers, unsigned count, unsigned depth);
+
+/* alternatives list for input at str */
+static const unsigned* branch_list(struct pco_ctx* ctx, const struct branch_table* table, const char* str)
+{
+	if (str == ctx->end) {
+		ctx->hit_end = true;
+
+		return table->lists + table->lookup[256];
+	}
+
+	return table->lists + table->lookup[(unsigned char) *str];
+}
+
+/* parser for pco_branch */
+static struct pco_result branch_parser(struct pco_ctx* ctx, struct branch_data* data, const char* str)
+{
+	const unsigned* list = branch_list(ctx, &data->table, str);
+	struct pco_result result;
+	unsigned i;
+
+	if (list[0] == 0) {
+		fail_set(ctx, str, &data->table.expected);
+
+		return fail_result(ctx, str);
+	}
+
+	for (i = 1; i <= list[0]; i++)
+		if ((result = call_parser(ctx, &data->parsers[list[i]], str)).status
+				== PCO_OK)
+			return result;
+
+	return result;
+}
+
+/* apply parsers from branch while parser not throw error, only parsers which
+ * can start with next input character are tried */
+struct pco_parser pco_branch(struct pco_ctx* ctx, struct pco_branch branch)
+{
+	return pco_branch_n(ctx, branch.parsers, branch.count);
+}
+
+/* apply count parsers from array while parser not throw error, only parsers which
+ * can start with next input character are tried */
+struct pco_parser pco_branch_n(struct pco_ctx* ctx, const struct pco_parser* parsers, unsigned count)
+{
+	struct branch_data* data = grammar_alloc(&ctx->grammar,
+			sizeof(struct branch_data) + count * sizeof(struct pco_parser));
+	data->count              = count;
+	memcpy(data->parsers, parsers, count * sizeof(struct pco_parser));
+
+	branch_table_create(&ctx->grammar, &data->table, &data->first, data->parsers, count, 0);
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) branch_parser,
+		.data   = data,
+	};
+}
+
+/* pco_int64, pco_uint64 and pco_float results are stored in place of pointers in result arrays */
+_Static_assert(sizeof(void*) >= sizeof(int64_t) && sizeof(void*) >= sizeof(double),
+		"int64_t and double results do not fit in result array slots");
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define INT_SWAR	/* convert 8 decimal digits at once */
+#endif
+
+#ifdef INT_SWAR
+/* convert 8 decimal digits at str to value, returns false if some of them is not digit */
+static inline bool int_digits8(const char* str, uint64_t* value)
+{
+	uint64_t v;
+
+	memcpy(&v, str, sizeof(v));
+
+	/* every byte is from 0x30 to 0x39 */
+	if ((v & 0xf0f0f0f0f0f0f0f0) != 0x3030303030303030
+			|| ((v + 0x0606060606060606) & 0xf0f0f0f0f0f0f0f0) != 0x3030303030303030)
+		return false;
+
+	/* combine digits to pairs, then pairs to 4 digits, then 4 digits to 8 */
+	v     -= 0x3030303030303030;
+	v      = v * 10 + (v >> 8);
+	*value = ((v & 0x000000ff000000ff) * (100 + (1000000ull << 32))
+			+ ((v >> 16) & 0x000000ff000000ff) * (1 + (10000ull << 32))) >> 32;
+
+	return true;
+}
+#endif
+
+/* parse decimal digits from str to value, returns end of digits */
+static const char* int_decimal(const char* str, const char* end, uint64_t* value, bool* overflow)
+{
+	uint64_t v = 0;
+	bool over  = false;
+
+#ifdef INT_SWAR
+	uint64_t chunk;
+
+	while (end - str >= 8 && int_digits8(str, &chunk)) {
+		over |= __builtin_mul_overflow(v, 100000000, &v);
+		over |= __builtin_add_overflow(v, chunk, &v);
+		str  += 8;
+	}
+#endif
+
+	for (; str != end && (unsigned char) (*str - '0') < 10; str++) {
+		over |= __builtin_mul_overflow(v, 10, &v);
+		over |= __builtin_add_overflow(v, (uint64_t) (*str - '0'), &v);
+	}
+
+	*value    = v;
+	*overflow = over;
+
+	return str;
+}
+
+/* map function for conversion digits slice to int in result type, clamps value to INT_MAX */
+static void integer_map(struct pco_ctx* ctx, struct pco_result* result)
+{
+	struct pco_slice* slice = result->data.result;
+	int* data               = result_alloc(ctx, sizeof(int));
+	uint64_t value;
+	bool overflow;
+
+	if (data == NULL) {
+		result->status = PCO_NO_MEMORY;
+		return;
+	}
+
+	int_decimal(slice->ptr, slice->ptr + slice->len, &value, &overflow);
+	*data               = overflow || value > INT_MAX ? INT_MAX : (int) value;
+	result->data.result = data;
+}
+
+/* parse decimal integer, sets result to int*, values above INT_MAX are clamped to
+ * INT_MAX, pco_int64 fails on overflow instead */
+struct pco_parser pco_integer(struct pco_ctx* ctx)
+{
+	struct pco_charset digits;
+
+	pco_create_charset(&digits);
+	pco_charset_add_range(&digits, '0', '9');
+
+	return pco_map(ctx, pco_slice(ctx, pco_charset_filter(ctx, &digits)), integer_map);
+}
+
+/* value of hex digit c, 16 for other characters */
+static unsigned int_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+
+	if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+		return (c | 0x20) - 'a' + 10;
+
+	return 16;
+}
+
+/* parse digits of base 1 << shift from str to value, returns end of digits */
+static const char* int_power2(const char* str, const char* end, unsigned shift, uint64_t* value, bool* overflow)
+{
+	uint64_t v = 0;
+	bool over  = false;
+	unsigned digit;
+
+	for (; str != end && (digit = int_digit(*str)) < 1u << shift; str++) {
+		over |= v >> (64 - shift) != 0;
+		v     = v << shift | digit;
+	}
+
+	*value    = v;
+	*overflow = over;
+
+	return str;
+}
+
+/* parse integer with sign and prefix allowed by flags, sets value to its
+ * magnitude, negative to its sign and rest to end of it */
+static struct pco_result int_parse(struct pco_ctx* ctx, unsigned flags, bool sign, const char* str,
+		uint64_t* value, bool* negative)
+{
+	struct pco_result result = {
+		.status = PCO_OK,
+	};
+	const char* pos = str;
+	const char* digits;
+	unsigned shift = 0;
+	bool overflow;
+
+	*negative = false;
+
+	if (pos != ctx->end && flags & PCO_INT_SIGN && (*pos == '+' || (sign && *pos == '-')))
+		*negative = *pos++ == '-';
+
+	if (flags & PCO_INT_PREFIX && pos != ctx->end && *pos == '0') {
+		/* prefix needs at least one digit after it */
+		if (ctx->end - pos < 3) {
+			ctx->hit_end = true;
+		} else {
+			switch (pos[1] | 0x20) {
+			case 'x':
+				shift = flags & PCO_INT_HEX ? 4 : 0;
+				break;
+
+			case 'o':
+				shift = flags & PCO_INT_OCT ? 3 : 0;
+				break;
+
+			case 'b':
+				shift = flags & PCO_INT_BIN ? 1 : 0;
+				break;
+			}
+
+			if (shift != 0 && int_digit(pos[2]) < 1u << shift)
+				pos += 2;
+			else
+				shift = 0;
+		}
+	}
+
+	digits = pos;
+	pos    = shift == 0 ? int_decimal(pos, ctx->end, value, &overflow)
+		: int_power2(pos, ctx->end, shift, value, &overflow);
+
+	if (pos == ctx->end)
+		ctx->hit_end = true;
+
+	if (pos == digits) {
+		fail_range(ctx, pos, '0', '9');
+
+		return fail_result(ctx, pos);
+	}
+
+	/* magnitude of signed integer is up to 2^63 for negative and 2^63 - 1 for positive */
+	if (overflow || (sign && *value > (uint64_t) INT64_MAX + *negative)) {
+		fail_overflow(ctx, str);
+
+		result.status = PCO_OVERFLOW;
+	}
+
+	result.rest = pos;
+
+	return result;
+}
+
+/* structure for data in int64 and uint64 parsers */
+struct int_data {
+	unsigned flags;	/* PCO_INT_* flags */
+};
+
+/* parser for pco_int64 */
+static struct pco_result int64_parser(struct pco_ctx* ctx, struct int_data* data, const char* str)
+{
+	uint64_t value;
+	bool negative;
+	struct pco_result result = int_parse(ctx, data->flags, true, str, &value, &negative);
+
+	if (result.status == PCO_OK)
+		result.data.integer = negative && value != 0 ? -(int64_t) (value - 1) - 1 : (int64_t) value;
+
+	return result;
+}
+
+/* parser for pco_uint64 */
+static struct pco_result uint64_parser(struct pco_ctx* ctx, struct int_data* data, const char* str)
+{
+	uint64_t value;
+	bool negative;
+	struct pco_result result = int_parse(ctx, data->flags, false, str, &value, &negative);
+
+	if (result.status == PCO_OK)
+		result.data.uinteger = value;
+
+	return result;
+}
+
+/* parse decimal integer, flags allow sign and 0x, 0o and 0b prefixes, sets result
+ * data.integer, fails with PCO_OVERFLOW if integer does not fit in int64_t */
+struct pco_parser pco_int64(struct pco_ctx* ctx, unsigned flags)
+{
+	struct int_data* data = size_alloc(&ctx->grammar, struct int_data);
+	data->flags           = flags;
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) int64_parser,
+		.data   = data,
+	};
+}
+
+/* parse decimal integer, flags allow + sign and 0x, 0o and 0b prefixes, sets result
+ * data.uinteger, fails with PCO_OVERFLOW if integer does not fit in uint64_t */
+struct pco_parser pco_uint64(struct pco_ctx* ctx, unsigned flags)
+{
+	struct int_data* data = size_alloc(&ctx->grammar, struct int_data);
+	data->flags           = flags;
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) uint64_parser,
+		.data   = data,
+	};
+}
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define FLOAT_FAST	/* double arithmetic is not done in extended precision */
+#endif
+
+#define FLOAT_DIGITS	19	/* significant digits that always fit in uint64_t */
+#define FLOAT_EXPONENT	100000	/* exponent magnitude clamp, result is zero or infinity long before it */
+#define FLOAT_BUFFER	64	/* longest number converted without allocation */
+
+#ifdef FLOAT_FAST
+/* powers of ten that are exact in double */
+static const double float_powers[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#endif
+
+/* decimal number as mantissa * 10^exponent */
+struct float_decimal {
+	uint64_t mantissa;	/* first FLOAT_DIGITS significant digits */
+	unsigned count;		/* upper bound of significant digits in mantissa */
+	int64_t exponent;	/* decimal exponent */
+	bool truncated;		/* nonzero digits were dropped from mantissa */
+};
+
+/* append decimal digits from str to dec, fraction digits decrement exponent,
+ * returns end of digits */
+static const char* float_digits(const char* str, const char* end, struct float_decimal* dec, bool fraction)
+{
+#ifdef INT_SWAR
+	uint64_t chunk;
+
+	while (dec->count + 8 <= FLOAT_DIGITS && end - str >= 8 && int_digits8(str, &chunk)) {
+		if (dec->mantissa != 0 || chunk != 0)
+			dec->count += 8;
+
+		dec->mantissa  = dec->mantissa * 100000000 + chunk;
+		dec->exponent -= fraction ? 8 : 0;
+		str           += 8;
+	}
+#endif
+
+	for (; str != end && (unsigned char) (*str - '0') < 10; str++) {
+		if (dec->count < FLOAT_DIGITS) {
+			if (dec->mantissa != 0 || *str != '0')
+				dec->count++;
+
+			dec->mantissa  = dec->mantissa * 10 + (uint64_t) (*str - '0');
+			dec->exponent -= fraction;
+		} else {
+			dec->truncated |= *str != '0';
+			dec->exponent  += !fraction;
+		}
+	}
+
+	return str;
+}
+
+static locale_t float_locale;				/* C locale for strtod, created once */
+static pthread_once_t float_locale_once = PTHREAD_ONCE_INIT;
+
+/* create C locale, strtod in it expects . as decimal point */
+static void float_locale_create(void)
+{
+	float_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+}
+
+/* convert number from str to rest with strtod, used when fast path is not exact,
+ * returns 0 if memory for long number copy ends */
+static double float_slow(struct pco_ctx* ctx, const char* str, const char* rest)
+{
+	size_t size          = (size_t) (rest - str) + 1;
+	struct pco_mark mark = arena_mark(&ctx->results);
+	char buf[FLOAT_BUFFER];
+	char* copy           = size <= sizeof(buf) ? buf : result_alloc(ctx, size);
+	locale_t old         = (locale_t) 0;
+	double value;
+
+	if (copy == NULL)
+		return 0;
+
+	memcpy(copy, str, size - 1);
+	copy[size - 1] = '\0';
+
+	/* locale of thread is switched, process locale and localeconv are not thread safe */
+	pthread_once(&float_locale_once, float_locale_create);
+
+	if (float_locale != (locale_t) 0)
+		old = uselocale(float_locale);
+
+	value = strtod(copy, NULL);
+
+	if (old != (locale_t) 0)
+		uselocale(old);
+
+	arena_rewind(&ctx->results, mark);
+
+	return value;
+}
+
+/* parser for pco_float */
+static struct pco_result float_parser(struct pco_ctx* ctx, void* data, const char* str)
+{
+	struct pco_result result = {
+		.status = PCO_OK,
+	};
+	struct float_decimal dec = {0};
+	const char* pos          = str;
+	const char* digits;
+	const char* marker;
+	bool negative            = false;
+	bool exponent_negative;
+	int64_t exponent         = 0;
+	double value;
+
+	if (pos != ctx->end && *pos == '-') {
+		negative = true;
+		pos++;
+	}
+
+	/* integer part is 0 or starts with nonzero digit */
+	digits = pos;
+
+	if (pos != ctx->end && *pos == '0')
+		pos++;
+	else if (pos != ctx->end && *pos != '0')
+		pos = float_digits(pos, ctx->end, &dec, false);
+
+	if (pos == digits) {
+		if (pos == ctx->end)
+			ctx->hit_end = true;
+
+		fail_range(ctx, pos, '0', '9');
+
+		return fail_result(ctx, pos);
+	}
+
+	/* fraction and exponent are optional, their marker without digits is left as rest */
+	if (pos != ctx->end && *pos == '.') {
+		digits = float_digits(pos + 1, ctx->end, &dec, true);
+
+		if (digits == pos + 1)
+			fail_range(ctx, digits, '0', '9');
+		else
+			pos = digits;
+
+		ctx->hit_end |= digits == ctx->end;
+	}
+
+	if (pos != ctx->end && (*pos | 0x20) == 'e') {
+		digits            = pos + 1;
+		exponent_negative = digits != ctx->end && *digits == '-';
+
+		if (digits != ctx->end && (*digits == '+' || *digits == '-'))
+			digits++;
+
+		for (marker = digits; marker != ctx->end && (unsigned char) (*marker - '0') < 10; marker++)
+			if (exponent < FLOAT_EXPONENT)
+				exponent = exponent * 10 + (*marker - '0');
+
+		ctx->hit_end |= marker == ctx->end;
+
+		if (marker == digits) {
+			fail_range(ctx, digits, '0', '9');
+		} else {
+			pos      = marker;
+			exponent = exponent_negative ? -exponent : exponent;
+		}
+	}
+
+	if (pos == ctx->end)
+		ctx->hit_end = true;
+
+	exponent += dec.exponent;
+
+	if (dec.mantissa == 0) {
+		value = 0;
+#ifdef FLOAT_FAST
+	/* both operands are exact, so single rounding of product or quotient is correct */
+	} else if (!dec.truncated && dec.mantissa <= (uint64_t) 1 << 53 && exponent >= -22 && exponent <= 22) {
+		value = exponent < 0 ? (double) dec.mantissa / float_powers[-exponent]
+			: (double) dec.mantissa * float_powers[exponent];
+#endif
+	} else {
+		value = float_slow(ctx, str + negative, pos);
+	}
+
+	if (value > DBL_MAX) {
+		fail_overflow(ctx, str);
+
+		result.status = PCO_OVERFLOW;
+	}
+
+	result.rest        = pos;
+	result.data.number = negative ? -value : value;
+
+	return result;
+}
+
+/* parse json number, sets result data.number, fails with PCO_OVERFLOW if number
+ * is too big for double */
+struct pco_parser pco_float(struct pco_ctx* ctx)
+{
+	/* parser needs no data, but own data makes node distinct for profiler, names and memo */
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) float_parser,
+		.data   = size_alloc(&ctx->grammar, char),
+	};
+}
+
+/* parse \t or space character many times or parse nothing */
+struct pco_parser pco_manyspace(struct pco_ctx* ctx)
+{
+	return pco_not_empty_repeat(ctx, pco_anyspace(ctx));
+}
+
+/* make result from characters from str to rest, copies characters to ctx */
+static struct pco_result span_result(struct pco_ctx* ctx, const char* str, const char* rest)
+{
+	struct pco_result result = {
+		.status = PCO_OK,
+		.rest   = rest,
+	};
+
+	if (rest == ctx->end)
+		ctx->hit_end = true;
+
+	if (ctx->discard)
+		return result;
+
+	if ((result.data.result = result_alloc(ctx, rest - str + 1)) == NULL)
+		return result;
+
+	memcpy(result.data.result, str, rest - str);
+	((char*) result.data.result)[rest - str] = '\0';
+
+	return result;
+}
+
+/* structure for data in filter parser */
+struct filter_data {
+	pco_filter_f filter;	/* filter function */
+};
+
+/* parser function for pco_filter */
+static struct pco_result filter_parser(struct pco_ctx* ctx, struct filter_data* data, const char* str)
+{
+	const char* c;
+
+	for (c = str; c != ctx->end && data->filter(*c); c++);
+
+	return span_result(ctx, str, c);
+}
+
+/* parse characters while filter return true, sets result to char* from parsed characters */
+struct pco_parser pco_filter(struct pco_ctx* ctx, pco_filter_f filter)
+{
+	struct filter_data* data = size_alloc(&ctx->grammar, struct filter_data);
+	data->filter             = filter;
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) filter_parser,
+		.data   = data,
+	};
+}
+
+#define charset_has(set, c) ((set)->chars[(unsigned char) (c) / 8] & 1 << (unsigned char) (c) % 8)
+
+/* create empty character set */
+void pco_create_charset(struct pco_charset* set)
+{
+	memset(set->chars, 0, sizeof(set->chars));
+}
+
+/* add character to set */
+void pco_charset_add(struct pco_charset* set, char c)
+{
+	set->chars[(unsigned char) c / 8] |= 1 << (unsigned char) c % 8;
+}
+
+/* add characters from first to last to set */
+void pco_charset_add_range(struct pco_charset* set, char first, char last)
+{
+	unsigned c;
+
+	for (c = (unsigned char) first; c <= (unsigned char) last; c++)
+		pco_charset_add(set, c);
+}
+
+/* add characters for which filter return true to set */
+void pco_charset_add_filter(struct pco_charset* set, pco_filter_f filter)
+{
+	unsigned c;
+
+	for (c = 0; c < 256; c++)
+		if (filter(c))
+			pco_charset_add(set, c);
+}
+
+/* check if character in set */
+bool pco_charset_has(const struct pco_charset* set, char c)
+{
+	return charset_has(set, c);
+}
+
+/* parser function for pco_charset */
+static inline struct pco_result charset_parser(struct pco_ctx* ctx, struct pco_charset* set, const char* str)
+{
+	struct pco_result result = {
+		.status      = PCO_OK,
+		.rest        = str + 1,
+		.data.result = (char*) str,
+	};
+
+	if (str == ctx->end) {
+		result.status = PCO_END_OF_INPUT;
+		ctx->hit_end  = true;
+		fail_set(ctx, str, set);
+
+		goto fail;
+	}
+
+	if (!charset_has(set, *str)) {
+		result.status         = PCO_UNEXEPTED;
+		result.data.unexepted = *str;
+		fail_set(ctx, str, set);
+	}
+
+fail:
+	return result;
+}
+
+/* parse one character from set, sets result to char* pointing to character in input */
+struct pco_parser pco_charset(struct pco_ctx* ctx, const struct pco_charset* set)
+{
+	struct pco_charset* data = size_alloc(&ctx->grammar, struct pco_charset);
+	*data                    = *set;
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) charset_parser,
+		.data   = data,
+	};
+}
+
+/* parse one character from first to last, sets result to char* pointing to character in input */
+struct pco_parser pco_range(struct pco_ctx* ctx, char first, char last)
+{
+	struct pco_charset set;
+
+	pco_create_charset(&set);
+	pco_charset_add_range(&set, first, last);
+
+	return pco_charset(ctx, &set);
+}
+
+#define SPAN_RANGES 4	/* max ranges in set for simd kernels */
+
+struct span_data;
+
+/* find first character from str not in set */
+typedef const char* (*span_f)(const struct span_data* data, const char* str, const char* end);
+
+/* structure for data in charset filter parser */
+struct span_data {
+	struct pco_charset set;		/* characters set */
+	span_f span;			/* kernel for this set on this cpu */
+
+	unsigned ranges;		/* ranges count */
+	unsigned char first[SPAN_RANGES];	/* first characters of ranges */
+	unsigned char size[SPAN_RANGES];	/* ranges sizes minus one */
+};
+
+/* scalar span kernel */
+static const char* span_scalar(const struct span_data* data, const char* str, const char* end)
+{
+	while (str != end && charset_has(&data->set, *str))
+		str++;
+
+	return str;
+}
+
+#ifdef SPAN_X86
+/* sse2 span kernel, checks 16 characters at once against set ranges */
+__attribute__((target("sse2")))
+static const char* span_sse2(const struct span_data* data, const char* str, const char* end)
+{
+	while (end - str >= 16) {
+		__m128i chars = _mm_loadu_si128((const __m128i*) str);
+		__m128i in    = _mm_setzero_si128();
+		unsigned mask, i;
+
+		for (i = 0; i < data->ranges; i++) {
+			__m128i x = _mm_sub_epi8(chars, _mm_set1_epi8(data->first[i]));
+
+			in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(data->size[i])), x));
+		}
+
+		if ((mask = _mm_movemask_epi8(in)) != 0xffff)
+			return str + __builtin_ctz(~mask);
+
+		str += 16;
+	}
+
+	return span_scalar(data, str, end);
+}
+
+/* avx2 span kernel, checks 32 characters at once against set ranges */
+__attribute__((target("avx2")))
+static const char* span_avx2(const struct span_data* data, const char* str, const char* end)
+{
+	while (end - str >= 32) {
+		__m256i chars = _mm256_loadu_si256((const __m256i*) str);
+		__m256i in    = _mm256_setzero_si256();
+		unsigned mask, i;
+
+		for (i = 0; i < data->ranges; i++) {
+			__m256i x = _mm256_sub_epi8(chars, _mm256_set1_epi8(data->first[i]));
+
+			in = _mm256_or_si256(in, _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(data->size[i])), x));
+		}
+
+		if ((mask = _mm256_movemask_epi8(in)) != 0xffffffff)
+			return str + __builtin_ctz(~mask);
+
+		str += 32;
+	}
+
+	return span_sse2(data, str, end);
+}
+#endif
+
+/* parser function for pco_charset_filter */
+static struct pco_result span_parser(struct pco_ctx* ctx, struct span_data* data, const char* str)
+{
+	return span_result(ctx, str, data->span(data, str, ctx->end));
+}
+
+/* parse characters while they are in set, sets result to char* from parsed characters */
+struct pco_parser pco_charset_filter(struct pco_ctx* ctx, const struct pco_charset* set)
+{
+	struct span_data* data = size_alloc(&ctx->grammar, struct span_data);
+	unsigned c;
+
+	data->set    = *set;
+	data->span   = span_scalar;
+	data->ranges = 0;
+
+	/* split set to ranges for simd kernels */
+	for (c = 0; c < 256; c++) {
+		if (!charset_has(set, c) || (c != 0 && charset_has(set, c - 1)))
+			continue;
+
+		if (data->ranges++ == SPAN_RANGES)
+			break;
+
+		data->first[data->ranges - 1] = c;
+		data->size[data->ranges - 1]  = 0;
+
+		while (c + 1 < 256 && charset_has(set, c + 1))
+			data->size[data->ranges - 1] = ++c - data->first[data->ranges - 1];
+	}
+
+#ifdef SPAN_X86
+	if (data->ranges <= SPAN_RANGES) {
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx2"))
+			data->span = span_avx2;
+		else if (__builtin_cpu_supports("sse2"))
+			data->span = span_sse2;
+	}
+#endif
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) span_parser,
+		.data   = data,
+	};
+}
+
+/* structure for data in sequence parser */
+struct sequence_data {
+	unsigned count;			/* parsers count */
+	struct pco_parser parsers[];	/* parsers */
+};
+
+/* parser function for pco_sequence */
+static struct pco_result sequence_parser(struct pco_ctx* ctx, struct sequence_data* data, const char* str)
+{
+	struct pco_result_array* arr = create_arr(ctx, data->count);
+	struct pco_result parser_result;
+	const char* rest = str;
+	unsigned i;
+
+	for (i = 0; i < data->count; i++) {
+		if ((parser_result = call_parser(ctx, &data->parsers[i], rest)).status
+				!= PCO_OK)
+			return parser_result;
+
+		rest = parser_result.rest;
+		add_to_arr(ctx, arr, parser_result.data.result);
+	}
+
+	return arr_result(arr, rest);
+}
+
+/* apply all parsers from sequence */
+struct pco_parser pco_sequence(struct pco_ctx* ctx, struct pco_branch sequence)
+{
+	return pco_sequence_n(ctx, sequence.parsers, sequence.count);
+}
+
+/* apply count parsers from array one after another */
+struct pco_parser pco_sequence_n(struct pco_ctx* ctx, const struct pco_parser* parsers, unsigned count)
+{
+	struct sequence_data* data = grammar_alloc(&ctx->grammar,
+			sizeof(struct sequence_data) + count * sizeof(struct pco_parser));
+	data->count                = count;
+	memcpy(data->parsers, parsers, count * sizeof(struct pco_parser));
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) sequence_parser,
+		.data   = data,
+	};
+}
+
+/* children of branch or sequence parser */
+static struct pco_parser* parser_children(struct pco_parser parser, unsigned* count)
+{
+	if (parser.parser == (pco_parser_f) branch_parser) {
+		*count = ((struct branch_data*) parser.data)->count;
+
+		return ((struct branch_data*) parser.data)->parsers;
+	}
+
+	*count = ((struct sequence_data*) parser.data)->count;
+
+	return ((struct sequence_data*) parser.data)->parsers;
+}
+
+/* structure for data in map parser */
+struct map_data {
+	struct pco_parser parser;
+	unsigned count;		/* maps count, stacked maps are collapsed by pco_optimize */
+	pco_map_f maps[];	/* maps applied in order */
+};
+
+/* apply maps to result of successful parser, maps are not called in discard mode
+ * and after memory ended because result they would process is not built */
+static inline void map_apply(struct pco_ctx* ctx, const pco_map_f* maps, unsigned count, struct pco_result* result)
+{
+	unsigned i;
+
+	if (result->status != PCO_OK || ctx->discard || ctx->no_memory)
+		return;
+
+	for (i = 0; i < count; i++)
+		maps[i](ctx, result);
+}
+
+/* parser function for pco_map */
+static struct pco_result map_parser(struct pco_ctx* ctx, struct map_data* map_data, const char* str)
+{
+	struct pco_result result = call_parser(ctx, &map_data->parser, str);
+
+	map_apply(ctx, map_data->maps, map_data->count, &result);
+
+	return result;
+}
+
+/* process other parser result, map is not called inside pco_slice, pco_skip and
+ * skip combinators because results are not built there, so map which fails
+ * result to reject input does not reject it there, use pco_check for that */
+struct pco_parser pco_map(struct pco_ctx* ctx, struct pco_parser parser, pco_map_f map)
+{
+	struct map_data* data = grammar_alloc(&ctx->grammar, sizeof(struct map_data) + sizeof(pco_map_f));
+	*data                 = (struct map_data) {
+		.parser = parser,
+		.count  = 1,
+	};
+	data->maps[0] = map;
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) map_parser,
+		.data   = data,
+	};
+}
+
+/* structure for data in check parser */
+struct check_data {
+	struct pco_parser parser;	/* checked parser */
+	pco_check_f check;		/* check of matched input */
+};
+
+/* parser function for pco_check, matched input is checked in discard mode too */
+static struct pco_result check_parser(struct pco_ctx* ctx, struct check_data* data, const char* str)
+{
+	struct pco_result result = call_parser(ctx, &data->parser, str);
+
+	if (result.status == PCO_OK && !data->check(ctx, str, (size_t) (result.rest - str)))
+		return fail_result(ctx, str);
+
+	return result;
+}
+
+/* apply parser and fail at its start if check returns false for len matched bytes
+ * at str, check is called inside pco_slice, pco_skip and skip combinators too,
+ * so it rejects input there, unlike map */
+struct pco_parser pco_check(struct pco_ctx* ctx, struct pco_parser parser, pco_check_f check)
+{
+	struct check_data* data = size_alloc(&ctx->grammar, struct check_data);
+	*data                   = (struct check_data) {
+		.parser = parser,
+		.check  = check,
+	};
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) check_parser,
+		.data   = data,
+	};
+}
+
+/* parser function for pco_not_empty_repeat */
+static struct pco_result not_empty_repeat_parser(struct pco_ctx* ctx, struct repeat_data* data, const char* str)
+{
+	struct pco_result result = repeat_parser(ctx, data, str);
+
+	if (result.rest == str)
+		return fail_result(ctx, str);
+
+	return result;
+}
+
+/* apply parser many times while it not throw error but output should be not empty */
+struct pco_parser pco_not_empty_repeat(struct pco_ctx* ctx, struct pco_parser parser)
+{
+	struct pco_parser repeat = pco_repeat(ctx, parser);
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) not_empty_repeat_parser,
+		.data   = repeat.data,
+	};
+}
+
+/* make slice from str to rest in ctx */
+static struct pco_slice* slice_result(struct pco_ctx* ctx, const char* str, const char* rest)
+{
+	struct pco_slice* slice;
+
+	if (ctx->discard)
+		return NULL;
+
+	if ((slice = result_alloc(ctx, sizeof(struct pco_slice))) == NULL)
+		return NULL;
+
+	*slice = (struct pco_slice) {
+		.ptr = str,
+		.len = rest - str,
+	};
+
+	return slice;
+}
+
+/* parser function for pco_slice */
+static struct pco_result slice_parser(struct pco_ctx* ctx, struct pco_parser* parser, const char* str)
+{
+	struct pco_result result;
+
+	ctx->discard++;
+	result = call_parser(ctx, parser, str);
+	ctx->discard--;
+
+	if (result.status == PCO_OK)
+		result.data.result = slice_result(ctx, str, result.rest);
+
+	return result;
+}
+
+/* apply parser without building its results and without calling maps in it, so
+ * status set by maps is ignored, sets result to struct pco_slice* of parsed input */
+struct pco_parser pco_slice(struct pco_ctx* ctx, struct pco_parser parser)
+{
+	struct pco_parser* data = size_alloc(&ctx->grammar, parser);
+	*data                   = parser;
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) slice_parser,
+		.data   = data,
+	};
+}
+
+/* parser function for pco_skip */
+static struct pco_result skip_parser(struct pco_ctx* ctx, struct pco_parser* parser, const char* str)
+{
+	struct pco_result result;
+
+	ctx->discard++;
+	result = call_parser(ctx, parser, str);
+	ctx->discard--;
+
+	if (result.status == PCO_OK)
+		result.data.result = NULL;
+
+	return result;
+}
+
+/* apply parser without building its results and without calling maps in it, so
+ * status set by maps is ignored, sets result to NULL */
+struct pco_parser pco_skip(struct pco_ctx* ctx, struct pco_parser parser)
+{
+	struct pco_parser* data = size_alloc(&ctx->grammar, parser);
+	*data                   = parser;
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) skip_parser,
+		.data   = data,
+	};
+}
+
+/* apply parser many times while it not throw error without building results, sets result to NULL */
+struct pco_parser pco_skip_repeat(struct pco_ctx* ctx, struct pco_parser parser)
+{
+	return pco_skip(ctx, pco_repeat(ctx, parser));
+}
+
+/* apply all parsers from sequence without building results, sets result to NULL */
+struct pco_parser pco_skip_sequence(struct pco_ctx* ctx, struct pco_branch sequence)
+{
+	return pco_skip(ctx, pco_sequence_n(ctx, sequence.parsers, sequence.count));
+}
+
+/* apply count parsers from array one after another without building results, sets result to NULL */
+struct pco_parser pco_skip_sequence_n(struct pco_ctx* ctx, const struct pco_parser* parsers, unsigned count)
+{
+	return pco_skip(ctx, pco_sequence_n(ctx, parsers, count));
+}
+
+/* skip \t, \n and space characters or nothing, sets result to NULL */
+struct pco_parser pco_skipspace(struct pco_ctx* ctx)
+{
+	struct pco_charset spaces;
+
+	pco_create_charset(&spaces);
+	pco_charset_add(&spaces, '\t');
+	pco_charset_add(&spaces, ' ');
+	pco_charset_add(&spaces, '\n');
+
+	return pco_skip(ctx, pco_charset_filter(ctx, &spaces));
+}
+
+/* parser function for pco_ptr */
+static struct pco_result ptr_parser(struct pco_ctx* ctx, struct pco_parser* parser, const char* str)
+{
+	return call_parser(ctx, parser, str);
+}
+
+/* apply parser from parser (useful in recursive parsers) */
+struct pco_parser pco_ptr(struct pco_ctx* ctx, struct pco_parser* parser)
+{
+	assert(parser != NULL);
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) ptr_parser,
+		.data   = parser,
+	};
+}
+
+/* cached result of memoized parser */
+struct pco_memo_entry {
+	unsigned gen;			/* generation, entry is empty if not equal to memo gen */
+	bool discard;			/* results were discarded */
+	const void* node;		/* memoized parser */
+	const char* str;		/* input position */
+	struct pco_result result;	/* cached result */
+};
+
+/* key of memo entry inserted while pco_fold runs */
+struct pco_memo_key {
+	const void* node;	/* memoized parser */
+	const char* str;	/* input position */
+	bool discard;		/* results were discarded */
+};
+
+#define MEMO_PROBES 8	/* max probes in memo table before eviction */
+
+/* memo table slot for node at str */
+static size_t memo_hash(const struct pco_memo* memo, const void* node, const char* str)
+{
+	uint64_t hash = ((uintptr_t) node ^ ((uintptr_t) str * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+
+	return (hash ^ (hash >> 32)) & (memo->size - 1);
+}
+
+/* find cached result of node at str */
+static struct pco_memo_entry* memo_find(struct pco_memo* memo, const void* node, const char* str, bool discard)
+{
+	size_t slot;
+	unsigned i;
+
+	if (memo->size == 0)
+		return NULL;
+
+	for (i = 0, slot = memo_hash(memo, node, str); i < MEMO_PROBES; i++, slot = (slot + 1) & (memo->size - 1)) {
+		struct pco_memo_entry* entry = &memo->entries[slot];
+
+		if (entry->gen != memo->gen)
+			return NULL;
+
+		if (entry->node == node && entry->str == str && entry->discard == discard)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/* insert entry without growing table, evicts old entry on collision */
+static void memo_put(struct pco_memo* memo, const struct pco_memo_entry* entry)
+{
+	size_t first = memo_hash(memo, entry->node, entry->str);
+	size_t slot;
+	unsigned i;
+
+	/* empty slot or entry forgotten by memo_forget */
+	for (i = 0, slot = first; i < MEMO_PROBES; i++, slot = (slot + 1) & (memo->size - 1))
+		if (memo->entries[slot].gen != memo->gen || memo->entries[slot].node == NULL)
+			break;
+
+	if (i == MEMO_PROBES)
+		slot = first;
+	else
+		memo->count++;
+
+	memo->entries[slot]     = *entry;
+	memo->entries[slot].gen = memo->gen;
+}
+
+/* double memo table size while it fits in limit */
+static void memo_grow(struct pco_memo* memo)
+{
+	struct pco_memo_entry* old = memo->entries;
+	size_t old_size            = memo->size;
+	size_t i;
+
+	memo->size    = old_size == 0 ? 64 : old_size * 2;
+	memo->entries = PCO_CALLOC(memo->size, sizeof(struct pco_memo_entry));
+	memo->count   = 0;
+
+	for (i = 0; i < old_size; i++)
+		if (old[i].gen == memo->gen && old[i].node != NULL)
+			memo_put(memo, &old[i]);
+
+	PCO_FREE(old);
+}
+
+/* cache result of node at str */
+static void memo_insert(struct pco_memo* memo, const void* node, const char* str, bool discard,
+		struct pco_result result)
+{
+	if ((memo->count + 1) * 4 > memo->size * 3 && memo->size * 2 <= memo->limit)
+		memo_grow(memo);
+
+	if (memo->size == 0)
+		return;
+
+	memo_put(memo, &(struct pco_memo_entry) {
+		.discard = discard,
+		.node    = node,
+		.str     = str,
+		.result  = result,
+	});
+
+	if (memo->folds == 0)
+		return;
+
+	if (memo->log_count == memo->log_size) {
+		memo->log_size = memo->log_size == 0 ? 64 : memo->log_size * 2;
+		memo->log      = PCO_REALLOC(memo->log, memo->log_size * sizeof(struct pco_memo_key));
+	}
+
+	memo->log[memo->log_count++] = (struct pco_memo_key) {
+		.node    = node,
+		.str     = str,
+		.discard = discard,
+	};
+}
+
+/* forget entries inserted after count keys were logged, they stay in table
+ * with NULL node so probing goes on past them */
+static void memo_forget(struct pco_memo* memo, size_t count)
+{
+	struct pco_memo_entry* entry;
+	struct pco_memo_key* key;
+
+	for (; memo->log_count > count; memo->log_count--) {
+		key   = &memo->log[memo->log_count - 1];
+		entry = memo_find(memo, key->node, key->str, key->discard);
+
+		if (entry != NULL) {
+			entry->node = NULL;
+			memo->count--;
+		}
+	}
+}
+
+/* parser function for pco_memo */
+static struct pco_result memo_parser(struct pco_ctx* ctx, struct pco_parser* parser, const char* str)
+{
+	struct pco_memo_entry* entry = memo_find(&ctx->memo, parser, str, ctx->discard != 0);
+	struct pco_result result;
+
+	if (entry != NULL)
+		return entry->result;
+
+	result = call_parser(ctx, parser, str);
+	memo_insert(&ctx->memo, parser, str, ctx->discard != 0, result);
+
+	return result;
+}
+
+/* cache parser results by input position (packrat parsing) */
+struct pco_parser pco_memo(struct pco_ctx* ctx, struct pco_parser parser)
+{
+	struct pco_parser* data = size_alloc(&ctx->grammar, parser);
+	*data                   = parser;
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) memo_parser,
+		.data   = data,
+	};
+}
+
+/* structure for data in fold parser */
+struct fold_data {
+	struct pco_parser parser;	/* repeated parser */
+	void* init;			/* initial accumulator */
+	pco_fold_f step;		/* fold function, may be NULL */
+};
+
+/* start fold, returns position of its first item results */
+static struct pco_mark fold_mark(struct pco_ctx* ctx)
+{
+	struct pco_mark mark = arena_mark(&ctx->results);
+	mark.keys            = ctx->memo.log_count;
+
+	ctx->memo.folds++;
+
+	return mark;
+}
+
+/* free results made since mark, cached results may point to them so memo
+ * entries inserted since mark are forgotten */
+static void fold_rewind(struct pco_ctx* ctx, struct pco_mark mark)
+{
+	arena_rewind(&ctx->results, mark);
+	memo_forget(&ctx->memo, mark.keys);
+}
+
+/* free results of last item and finish fold started at mark */
+static void fold_end(struct pco_ctx* ctx, struct pco_mark mark)
+{
+	fold_rewind(ctx, mark);
+
+	ctx->memo.folds--;
+}
+
+/* add item to accumulator and free results of item, step allocates in its
+ * own arena so accumulator outlives item results, step is not called after
+ * memory ended because item may be incomplete */
+static inline void* fold_step(struct pco_ctx* ctx, pco_fold_f step, void* acc, void* item, struct pco_mark mark)
+{
+	struct pco_arena results;
+
+	if (step != NULL && !ctx->discard && !ctx->no_memory) {
+		results      = ctx->results;
+		ctx->results = ctx->folds;
+		acc          = step(ctx, acc, item);
+		ctx->folds   = ctx->results;
+		ctx->results = results;
+	}
+
+	fold_rewind(ctx, mark);
+
+	return acc;
+}
+
+/* result of fold with accumulator acc */
+static struct pco_result fold_result(void* acc, const char* rest)
+{
+	return (struct pco_result) {
+		.status      = PCO_OK,
+		.rest        = rest,
+		.data.result = acc,
+	};
+}
+
+/* parser function for pco_fold */
+static struct pco_result fold_parser(struct pco_ctx* ctx, struct fold_data* data, const char* str)
+{
+	struct pco_mark mark = fold_mark(ctx);
+	struct pco_result result;
+	const char* rest = str;
+	void* acc        = data->init;
+
+	while ((result = call_parser(ctx, &data->parser, rest)).status == PCO_OK) {
+		rest = result.rest;
+		acc  = fold_step(ctx, data->step, acc, result.data.result, mark);
+	}
+
+	/* results of failed item */
+	fold_end(ctx, mark);
+
+	return fold_result(acc, rest);
+}
+
+/* apply parser many times while it not throw error, every result is passed to
+ * step with accumulator and freed after it, so parse results take constant
+ * memory, memory allocated by step in ctx is kept until pco_reset_ctx, sets
+ * result to accumulator returned by last step or init */
+struct pco_parser pco_fold(struct pco_ctx* ctx, struct pco_parser parser, void* init, pco_fold_f step)
+{
+	struct fold_data* data = size_alloc(&ctx->grammar, struct fold_data);
+	*data                  = (struct fold_data) {
+		.parser = parser,
+		.init   = init,
+		.step   = step,
+	};
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) fold_parser,
+		.data   = data,
+	};
+}
+
+/* set first set to all characters */
+static void first_any(struct first_set* set)
+{
+	memset(set->chars, 0xff, sizeof(set->chars));
+
+	set->empty = true;
+	set->exact = false;
+}
+
+/* add characters from src to set */
+static void first_union(struct first_set* set, const struct first_set* src)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(set->chars); i++)
+		set->chars[i] |= src->chars[i];
+
+	set->empty |= src->empty;
+	set->exact &= src->exact;
+}
+
+/* compute first set of parser, follows pco_ptr and branches without exact set depth times */
+static void first_set(struct first_set* set, struct pco_parser parser, unsigned depth)
+{
+	struct keywords_data* keywords;
+	struct pco_parser* children;
+	struct first_set child;
+	struct str_data* str;
+	unsigned count, i;
+
+	memset(set, 0, sizeof(struct first_set));
+	set->exact = true;
+
+	if (parser.parser == (pco_parser_f) char_parser) {
+		unsigned char c = *(char*) parser.data;
+
+		set->chars[c / 8] |= 1 << c % 8;
+	} else if (parser.parser == (pco_parser_f) str_parser) {
+		str = parser.data;
+
+		if (str->len == 0)
+			set->empty = true;
+		else
+			set->chars[(unsigned char) str->str[0] / 8] |= 1 << (unsigned char) str->str[0] % 8;
+	} else if (parser.parser == (pco_parser_f) filter_parser) {
+		memset(set->chars, 0xff, sizeof(set->chars));
+		set->empty = true;
+	} else if (parser.parser == (pco_parser_f) charset_parser) {
+		memcpy(set->chars, ((struct pco_charset*) parser.data)->chars, sizeof(set->chars));
+	} else if (parser.parser == (pco_parser_f) span_parser) {
+		memcpy(set->chars, ((struct span_data*) parser.data)->set.chars, sizeof(set->chars));
+		set->empty = true;
+	} else if (parser.parser == (pco_parser_f) repeat_parser) {
+		first_set(set, ((struct repeat_data*) parser.data)->parser, depth);
+		set->empty = true;
+	} else if (parser.parser == (pco_parser_f) not_empty_repeat_parser) {
+		first_set(set, ((struct repeat_data*) parser.data)->parser, depth);
+	} else if (parser.parser == (pco_parser_f) fold_parser) {
+		first_set(set, ((struct fold_data*) parser.data)->parser, depth);
+		set->empty = true;
+	} else if (parser.parser == (pco_parser_f) memo_parser || parser.parser == (pco_parser_f) slice_parser
+			|| parser.parser == (pco_parser_f) skip_parser || parser.parser == (pco_parser_f) name_parser) {
+		first_set(set, *(struct pco_parser*) parser.data, depth);
+	} else if (parser.parser == (pco_parser_f) map_parser) {
+		first_set(set, ((struct map_data*) parser.data)->parser, depth);
+	} else if (parser.parser == (pco_parser_f) check_parser) {
+		first_set(set, ((struct check_data*) parser.data)->parser, depth);
+	} else if (parser.parser == (pco_parser_f) branch_parser) {
+		*set = ((struct branch_data*) parser.data)->first;
+
+		if (!set->exact && depth != 0) {
+			children = parser_children(parser, &count);
+
+			memset(set, 0, sizeof(struct first_set));
+			set->exact = true;
+
+			for (i = 0; i < count; i++) {
+				first_set(&child, children[i], depth - 1);
+				first_union(set, &child);
+			}
+		}
+	} else if (parser.parser == (pco_parser_f) sequence_parser) {
+		children   = parser_children(parser, &count);
+		set->empty = true;
+
+		for (i = 0; i < count && set->empty; i++) {
+			first_set(&child, children[i], depth);
+
+			set->empty = false;
+			first_union(set, &child);
+		}
+	} else if (parser.parser == (pco_parser_f) int64_parser || parser.parser == (pco_parser_f) uint64_parser) {
+		for (i = '0'; i <= '9'; i++)
+			set->chars[i / 8] |= 1 << i % 8;
+
+		if (((struct int_data*) parser.data)->flags & PCO_INT_SIGN) {
+			set->chars['+' / 8] |= 1 << '+' % 8;
+
+			if (parser.parser == (pco_parser_f) int64_parser)
+				set->chars['-' / 8] |= 1 << '-' % 8;
+		}
+	} else if (parser.parser == (pco_parser_f) float_parser) {
+		for (i = '0'; i <= '9'; i++)
+			set->chars[i / 8] |= 1 << i % 8;
+
+		set->chars['-' / 8] |= 1 << '-' % 8;
+	} else if (parser.parser == (pco_parser_f) keywords_parser) {
+		keywords = parser.data;
+
+		for (i = 0; i < 256; i++)
+			if (keywords->root[i] != 0)
+				set->chars[i / 8] |= 1 << i % 8;
+
+		set->empty = keywords->nodes[0].word != NULL;
+	} else if (parser.parser == (pco_parser_f) ptr_parser && depth != 0) {
+		first_set(set, *(struct pco_parser*) parser.data, depth - 1);
+	} else
+		first_any(set);
+}
+
+/* build dispatch table for alternatives, sets first to first set of all alternatives */
+static void branch_table_create(struct pco_arena* arena, struct branch_table* table, struct first_set* first,
+		const struct pco_parser* parsers, unsigned count, unsigned depth)
+{
+	struct first_set* sets = PCO_MALLOC(count * sizeof(struct first_set));
+	unsigned* lists        = PCO_MALLOC(257 * (count + 1) * sizeof(unsigned));
+	unsigned* starts       = PCO_MALLOC(257 * sizeof(unsigned));
+	unsigned size = 0, starts_count = 0;
+	unsigned c, i, j;
+
+	memset(first, 0, sizeof(struct first_set));
+	first->exact = true;
+
+	for (i = 0; i < count; i++) {
+		first_set(&sets[i], parsers[i], depth);
+		first_union(first, &sets[i]);
+	}
+
+	for (c = 0; c < 257; c++) {
+		unsigned* list = &lists[size];
+
+		for (i = 0, list[0] = 0; i < count; i++)
+			if (sets[i].empty || (c < 256 && sets[i].chars[c / 8] & 1 << c % 8))
+				list[++list[0]] = i;
+
+		/* use same list for characters with same alternatives */
+		for (j = 0; j < starts_count; j++)
+			if (lists[starts[j]] == list[0] && !memcmp(&lists[starts[j]], list, (list[0] + 1) * sizeof(unsigned)))
+				break;
+
+		if (j == starts_count) {
+			starts[starts_count++] = size;
+			size                  += list[0] + 1;
+		}
+
+		table->lookup[c] = starts[j];
+	}
+
+	table->lists = grammar_alloc(arena, size * sizeof(unsigned));
+	memcpy(table->lists, lists, size * sizeof(unsigned));
+
+	memset(table->expected.chars, 0, sizeof(table->expected.chars));
+
+	for (c = 0; c < 256; c++)
+		if (table->lists[table->lookup[c]] != 0)
+			table->expected.chars[c / 8] |= 1 << c % 8;
+
+	PCO_FREE(sets);
+	PCO_FREE(lists);
+	PCO_FREE(starts);
+}
+
+/* optimized copy of grammar node */
+struct opt_node {
+	struct pco_parser from;		/* original parser */
+	struct pco_parser to;		/* optimized parser */
+	bool discard;			/* node is optimized for discard mode */
+};
+
+/* state of grammar optimizer */
+struct opt {
+	struct pco_ctx* ctx;		/* context for optimized grammar */
+	struct opt_node* nodes;		/* hash table of optimized nodes */
+	unsigned count;			/* nodes count */
+	unsigned capacity;		/* hash table size, power of 2 */
+
+	struct branch_data** branches;	/* new branches, tables are created when all nodes are built */
+	unsigned branches_count;	/* new branches count */
+	unsigned branches_capacity;	/* allocated branches */
+};
+
+/* list of parsers collected by optimizer */
+struct opt_list {
+	struct pco_parser* parsers;	/* parsers */
+	unsigned count;			/* parsers count */
+	unsigned capacity;		/* allocated parsers */
+};
+
+static struct pco_parser opt_parser(struct opt* opt, struct pco_parser parser, bool discard);
+
+/* add parser to list */
+static void opt_list_add(struct opt_list* list, struct pco_parser parser)
+{
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+		list->parsers  = PCO_REALLOC(list->parsers, list->capacity * sizeof(struct pco_parser));
+	}
+
+	list->parsers[list->count++] = parser;
+}
+
+/* skip parsers which do nothing in this mode: maps and pco_skip in discard mode,
+ * branches with one alternative and, in discard mode, sequences with one parser */
+static struct pco_parser opt_skip(struct pco_parser parser, bool discard)
+{
+	for (;;) {
+		if (parser.parser == (pco_parser_f) map_parser && discard)
+			parser = ((struct map_data*) parser.data)->parser;
+		else if (parser.parser == (pco_parser_f) skip_parser && discard)
+			parser = *(struct pco_parser*) parser.data;
+		else if (parser.parser == (pco_parser_f) branch_parser
+				&& ((struct branch_data*) parser.data)->count == 1)
+			parser = ((struct branch_data*) parser.data)->parsers[0];
+		else if (parser.parser == (pco_parser_f) sequence_parser && discard
+				&& ((struct sequence_data*) parser.data)->count == 1)
+			parser = ((struct sequence_data*) parser.data)->parsers[0];
+		else
+			return parser;
+	}
+}
+
+/* collect parsers of kind from parser and nested parsers of same kind, pco_ptr
+ * is not followed so recursive grammars are not unrolled */
+static void opt_flatten(struct opt_list* list, pco_parser_f kind, struct pco_parser parser, bool discard)
+{
+	struct pco_parser* children;
+	unsigned count, i;
+
+	parser = opt_skip(parser, discard);
+
+	if (parser.parser != kind) {
+		opt_list_add(list, parser);
+
+		return;
+	}
+
+	children = parser_children(parser, &count);
+
+	for (i = 0; i < count; i++)
+		opt_flatten(list, kind, children[i], discard);
+}
+
+/* literal of char or str parser, returns false for other parsers */
+static bool opt_literal(struct pco_parser parser, const char** str, size_t* len)
+{
+	if (parser.parser == (pco_parser_f) char_parser) {
+		*str = parser.data;
+		*len = 1;
+	} else if (parser.parser == (pco_parser_f) str_parser) {
+		*str = ((struct str_data*) parser.data)->str;
+		*len = ((struct str_data*) parser.data)->len;
+	} else
+		return false;
+
+	return true;
+}
+
+/* merge runs of adjacent literals in list to str parsers, results of
+ * merged parsers are lost so it is done only in discard mode */
+static void opt_merge(struct opt* opt, struct opt_list* list)
+{
+	struct str_data* data;
+	const char* lit;
+	size_t len, size;
+	unsigned i, j, count = 0;
+
+	for (i = 0; i < list->count; i = j) {
+		for (j = i, size = 0; j < list->count && opt_literal(list->parsers[j], &lit, &len); j++)
+			size += len;
+
+		if (j - i < 2) {
+			list->parsers[count++] = list->parsers[i];
+			j                      = i + 1;
+
+			continue;
+		}
+
+		data      = grammar_alloc(&opt->ctx->grammar, sizeof(struct str_data) + size + 1);
+		data->len = 0;
+
+		for (; i < j; i++) {
+			opt_literal(list->parsers[i], &lit, &len);
+			memcpy(data->str + data->len, lit, len);
+
+			data->len += len;
+		}
+
+		data->str[data->len]   = '\0';
+		list->parsers[count++] = (struct pco_parser) {
+			.parser = (pco_parser_f) str_parser,
+			.data   = data,
+		};
+	}
+
+	list->count = count;
+}
+
+/* hash table slot for parser optimized for discard mode or not */
+static unsigned opt_slot(const struct opt* opt, struct pco_parser from, bool discard)
+{
+	uint64_t hash = ((uintptr_t) from.data ^ discard) * 0x9e3779b97f4a7c15ull;
+	unsigned slot = (hash ^ (hash >> 32)) & (opt->capacity - 1);
+
+	while (opt->nodes[slot].from.parser != NULL && (opt->nodes[slot].from.parser != from.parser
+				|| opt->nodes[slot].from.data != from.data || opt->nodes[slot].discard != discard))
+		slot = (slot + 1) & (opt->capacity - 1);
+
+	return slot;
+}
+
+/* remember that from is optimized to to */
+static void opt_add(struct opt* opt, struct pco_parser from, struct pco_parser to, bool discard)
+{
+	unsigned i;
+
+	if (++opt->count * 2 > opt->capacity) {
+		struct opt_node* old = opt->nodes;
+		unsigned old_size    = opt->capacity;
+
+		opt->capacity = old_size * 2;
+		opt->nodes    = PCO_CALLOC(opt->capacity, sizeof(struct opt_node));
+
+		for (i = 0; i < old_size; i++)
+			if (old[i].from.parser != NULL)
+				opt->nodes[opt_slot(opt, old[i].from, old[i].discard)] = old[i];
+
+		PCO_FREE(old);
+	}
+
+	opt->nodes[opt_slot(opt, from, discard)] = (struct opt_node) {
+		.from    = from,
+		.to      = to,
+		.discard = discard,
+	};
+}
+
+/* optimize branch or sequence, nested branches are flattened and in discard
+ * mode nested sequences are flattened and literals are merged */
+static struct pco_parser opt_branch(struct opt* opt, struct pco_parser parser, bool discard)
+{
+	struct opt_list list     = {0};
+	struct branch_data* data = NULL;
+	struct pco_parser* original;
+	struct pco_parser* children;
+	struct pco_parser result;
+	const char* lit;
+	size_t len;
+	unsigned count, i;
+
+	/* sequence results are arrays of its parsers results, so their shape is kept outside of discard mode */
+	if (parser.parser == (pco_parser_f) branch_parser || discard)
+		opt_flatten(&list, parser.parser, parser, discard);
+
+	if (parser.parser == (pco_parser_f) sequence_parser && !discard) {
+		original = parser_children(parser, &count);
+
+		for (i = 0; i < count; i++)
+			opt_list_add(&list, original[i]);
+	}
+
+	if (parser.parser == (pco_parser_f) sequence_parser && discard) {
+		opt_merge(opt, &list);
+
+		/* whole sequence is one literal */
+		if (list.count == 1 && opt_literal(list.parsers[0], &lit, &len)) {
+			result = list.parsers[0];
+			opt_add(opt, parser, result, discard);
+
+			goto done;
+		}
+	}
+
+	if (parser.parser == (pco_parser_f) branch_parser) {
+		data        = grammar_alloc(&opt->ctx->grammar,
+				sizeof(struct branch_data) + list.count * sizeof(struct pco_parser));
+		data->count = list.count;
+		children    = data->parsers;
+		result      = (struct pco_parser) {
+			.parser = (pco_parser_f) branch_parser,
+			.data   = data,
+		};
+	} else {
+		struct sequence_data* sequence = grammar_alloc(&opt->ctx->grammar,
+				sizeof(struct sequence_data) + list.count * sizeof(struct pco_parser));
+		sequence->count                = list.count;
+		children                       = sequence->parsers;
+		result                         = (struct pco_parser) {
+			.parser = (pco_parser_f) sequence_parser,
+			.data   = sequence,
+		};
+	}
+
+	/* node is added before children are optimized, so recursion ends on it */
+	opt_add(opt, parser, result, discard);
+
+	for (i = 0; i < list.count; i++)
+		children[i] = opt_parser(opt, list.parsers[i], discard);
+
+	if (data != NULL) {
+		if (opt->branches_count == opt->branches_capacity) {
+			opt->branches_capacity = opt->branches_capacity == 0 ? 16 : opt->branches_capacity * 2;
+			opt->branches          = PCO_REALLOC(opt->branches,
+					opt->branches_capacity * sizeof(struct branch_data*));
+		}
+
+		opt->branches[opt->branches_count++] = data;
+	}
+
+done:
+	PCO_FREE(list.parsers);
+
+	return result;
+}
+
+/* optimize map, stacked maps are collapsed to one map which applies all of them */
+static struct pco_parser opt_map(struct opt* opt, struct pco_parser parser)
+{
+	struct pco_parser inner;
+	struct map_data* data;
+	struct map_data* map;
+	unsigned count = 0;
+
+	for (inner = parser; inner.parser == (pco_parser_f) map_parser; inner = map->parser) {
+		map    = inner.data;
+		count += map->count;
+	}
+
+	data        = grammar_alloc(&opt->ctx->grammar, sizeof(struct map_data) + count * sizeof(pco_map_f));
+	data->count = count;
+
+	/* inner maps are applied first */
+	for (inner = parser; inner.parser == (pco_parser_f) map_parser; inner = map->parser) {
+		map    = inner.data;
+		count -= map->count;
+
+		memcpy(&data->maps[count], map->maps, map->count * sizeof(pco_map_f));
+	}
+
+	opt_add(opt, parser, (struct pco_parser) { .parser = (pco_parser_f) map_parser, .data = data }, false);
+	data->parser = opt_parser(opt, inner, false);
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) map_parser,
+		.data   = data,
+	};
+}
+
+/* optimized copy of parser, in discard mode results and maps are not used */
+static struct pco_parser opt_parser(struct opt* opt, struct pco_parser parser, bool discard)
+{
+	struct pco_parser result;
+	unsigned slot;
+
+	/* pco_ptr targets are fixed now, so they are replaced with targets */
+	do {
+		while (parser.parser == (pco_parser_f) ptr_parser) {
+			parser = *(struct pco_parser*) parser.data;
+
+			assert(parser.parser != NULL && "pco_ptr target must be defined before pco_optimize");
+		}
+
+		parser = opt_skip(parser, discard);
+	} while (parser.parser == (pco_parser_f) ptr_parser);
+
+	result = parser;
+
+	slot = opt_slot(opt, parser, discard);
+
+	if (opt->nodes[slot].from.parser != NULL)
+		return opt->nodes[slot].to;
+
+	if (parser.parser == (pco_parser_f) branch_parser || parser.parser == (pco_parser_f) sequence_parser)
+		return opt_branch(opt, parser, discard);
+
+	if (parser.parser == (pco_parser_f) map_parser)
+		return opt_map(opt, parser);
+
+	if (parser.parser == (pco_parser_f) repeat_parser || parser.parser == (pco_parser_f) not_empty_repeat_parser) {
+		struct repeat_data* data = size_alloc(&opt->ctx->grammar, struct repeat_data);
+		*data                    = *(struct repeat_data*) parser.data;
+		result.data              = data;
+
+		opt_add(opt, parser, result, discard);
+		data->parser = opt_parser(opt, data->parser, discard);
+	} else if (parser.parser == (pco_parser_f) fold_parser) {
+		struct fold_data* data = size_alloc(&opt->ctx->grammar, struct fold_data);
+		*data                  = *(struct fold_data*) parser.data;
+		result.data            = data;
+
+		opt_add(opt, parser, result, discard);
+		data->parser = opt_parser(opt, data->parser, discard);
+	} else if (parser.parser == (pco_parser_f) memo_parser || parser.parser == (pco_parser_f) slice_parser
+			|| parser.parser == (pco_parser_f) skip_parser) {
+		struct pco_parser* data = size_alloc(&opt->ctx->grammar, struct pco_parser);
+		result.data             = data;
+
+		opt_add(opt, parser, result, discard);
+		*data = opt_parser(opt, *(struct pco_parser*) parser.data,
+				discard || parser.parser != (pco_parser_f) memo_parser);
+	} else if (parser.parser == (pco_parser_f) check_parser) {
+		/* unlike maps checks are kept in discard mode, they may reject input */
+		struct check_data* data = size_alloc(&opt->ctx->grammar, struct check_data);
+		*data                   = *(struct check_data*) parser.data;
+		result.data             = data;
+
+		opt_add(opt, parser, result, discard);
+		data->parser = opt_parser(opt, data->parser, discard);
+	} else if (parser.parser == (pco_parser_f) name_parser) {
+		struct name_data* data = size_alloc(&opt->ctx->grammar, struct name_data);
+		*data                  = *(struct name_data*) parser.data;
+		result.data            = data;
+
+		opt_add(opt, parser, result, discard);
+		data->parser = opt_parser(opt, data->parser, discard);
+	} else
+		opt_add(opt, parser, result, discard);
+
+	return result;
+}
+
+/* rewrite grammar to grammar with same results which needs fewer parser calls,
+ * pco_ptr targets must be defined before it, which is asserted, and must not be
+ * changed after it, gain depends on grammar and may be none, so measure it */
+struct pco_parser pco_optimize(struct pco_ctx* ctx, struct pco_parser parser)
+{
+	struct opt opt = {
+		.ctx      = ctx,
+		.nodes    = PCO_CALLOC(64, sizeof(struct opt_node)),
+		.capacity = 64,
+	};
+	struct branch_data* data;
+	unsigned i;
+
+	parser = opt_parser(&opt, parser, false);
+
+	/* first sets of new branches are unknown until their tables are created */
+	for (i = 0; i < opt.branches_count; i++)
+		first_any(&opt.branches[i]->first);
+
+	/* nested branches are created after outer ones, so their first sets are ready first */
+	for (i = opt.branches_count; i-- > 0;) {
+		data = opt.branches[i];
+
+		branch_table_create(&ctx->grammar, &data->table, &data->first, data->parsers, data->count, 0);
+	}
+
+	PCO_FREE(opt.nodes);
+	PCO_FREE(opt.branches);
+
+	return parser;
+}
+
+/* bytecode opcodes */
+enum vm_op {
+	OP_CHAR,	/* pco_char */
+	OP_STR,		/* pco_str */
+	OP_CHARSET,	/* pco_charset */
+	OP_FILTER,	/* pco_filter */
+	OP_SPAN,	/* pco_charset_filter */
+	OP_KEYWORDS,	/* pco_keywords */
+	OP_INT64,	/* pco_int64 */
+	OP_UINT64,	/* pco_uint64 */
+	OP_FLOAT,	/* pco_float */
+	OP_REPEAT,	/* pco_repeat */
+	OP_NOT_EMPTY,	/* pco_not_empty_repeat */
+	OP_BRANCH,	/* pco_branch */
+	OP_SEQUENCE,	/* pco_sequence */
+	OP_MAP,		/* pco_map */
+	OP_FOLD,	/* pco_fold */
+	OP_MEMO,	/* pco_memo */
+	OP_SLICE,	/* pco_slice */
+	OP_SKIP,	/* pco_skip */
+	OP_CALL,	/* any other parser, called through function pointer */
+};
+
+/* bytecode instruction */
+struct vm_insn {
+	enum vm_op op;		/* opcode */
+	bool leaf;		/* runs without stack frame, no children under up to VM_CHAIN maps, slices and skips */
+	bool flat;		/* branch of leaves or sequence of leaves and such branches, runs without stack frame */
+	unsigned count;		/* children count, capacity hint of repeat or maps count */
+	unsigned child;		/* child instruction, or first child index in program children */
+
+	union {
+		char c;				/* OP_CHAR character */
+		struct str_data* str;		/* OP_STR string */
+		struct pco_charset* set;	/* OP_CHARSET set */
+		struct filter_data* filter;	/* OP_FILTER filter */
+		struct span_data* span;		/* OP_SPAN set */
+		struct keywords_data* keywords;	/* OP_KEYWORDS trie */
+		struct int_data* integer;	/* OP_INT64 and OP_UINT64 flags */
+		const pco_map_f* maps;		/* OP_MAP map functions */
+		struct fold_data* fold;		/* OP_FOLD accumulator and step */
+		struct pco_parser* parser;	/* OP_CALL parser */
+		struct branch_table* table;	/* OP_BRANCH dispatch table */
+	} arg;
+};
+
+/* compiled parser */
+struct vm_program {
+	struct vm_insn* code;	/* instructions, first is entry point */
+	unsigned* children;	/* children of branches and sequences */
+};
+
+/* interpreter stack frame */
+struct vm_frame {
+	const struct vm_insn* insn;	/* executed instruction */
+	const char* str;		/* input position of instruction */
+	const char* rest;		/* input position of next child */
+	unsigned i;			/* next child */
+
+	union {
+		struct pco_result_array* arr;	/* children results */
+		const unsigned* list;		/* OP_BRANCH alternatives for input */
+
+		struct {
+			void* acc;		/* OP_FOLD accumulator */
+			struct pco_mark mark;	/* OP_FOLD results position before items */
+		};
+	};
+};
+
+#define VM_STACK_SIZE 64	/* frames on C stack before moving stack to heap */
+#define VM_CHAIN 4		/* max maps, slices and skips around leaf run without stack frame */
+
+#ifdef __GNUC__
+#define VM_INLINE inline __attribute__((always_inline))	/* keep dispatch in interpreter loop */
+#else
+#define VM_INLINE inline
+#endif
+
+/* child of insn */
+static inline const struct vm_insn* vm_child(const struct vm_program* program, const struct vm_insn* insn, unsigned i)
+{
+	return &program->code[program->children[insn->child + i]];
+}
+
+/* execute leaf instruction without stack frame: instruction without children,
+ * maybe under maps, slices and skips */
+static VM_INLINE void vm_leaf(struct pco_ctx* ctx, const struct vm_program* program, const struct vm_insn* insn,
+		const char* str, struct pco_result* result)
+{
+	const struct vm_insn* chain[VM_CHAIN];
+	unsigned count = 0;
+
+	while (insn->op == OP_MAP || insn->op == OP_SLICE || insn->op == OP_SKIP) {
+		ctx->discard  += insn->op != OP_MAP;
+		chain[count++] = insn;
+		insn           = &program->code[insn->child];
+	}
+
+	switch (insn->op) {
+	case OP_CHAR:
+		*result = char_parser(ctx, (char*) &insn->arg.c, str);
+		break;
+
+	case OP_STR:
+		*result = str_parser(ctx, insn->arg.str, str);
+		break;
+
+	case OP_CHARSET:
+		*result = charset_parser(ctx, insn->arg.set, str);
+		break;
+
+	case OP_FILTER:
+		*result = filter_parser(ctx, insn->arg.filter, str);
+		break;
+
+	case OP_SPAN:
+		*result = span_parser(ctx, insn->arg.span, str);
+		break;
+
+	case OP_KEYWORDS:
+		*result = keywords_parser(ctx, insn->arg.keywords, str);
+		break;
+
+	case OP_INT64:
+		*result = int64_parser(ctx, insn->arg.integer, str);
+		break;
+
+	case OP_UINT64:
+		*result = uint64_parser(ctx, insn->arg.integer, str);
+		break;
+
+	case OP_FLOAT:
+		*result = float_parser(ctx, NULL, str);
+		break;
+
+	default:
+		*result = call_parser(ctx, insn->arg.parser, str);
+		break;
+	}
+
+	while (count != 0) {
+		insn = chain[--count];
+
+		if (insn->op == OP_MAP) {
+			map_apply(ctx, insn->arg.maps, insn->count, result);
+			continue;
+		}
+
+		ctx->discard--;
+
+		if (result->status == PCO_OK)
+			result->data.result = insn->op == OP_SLICE ? slice_result(ctx, str, result->rest) : NULL;
+	}
+}
+
+/* execute branch alternatives from list on str, all of them must be leaves */
+static VM_INLINE void vm_choice(struct pco_ctx* ctx, const struct vm_program* program, const struct vm_insn* insn,
+		const unsigned* list, const char* str, struct pco_result* result)
+{
+	unsigned i;
+
+	if (list[0] == 0) {
+		fail_set(ctx, str, &insn->arg.table->expected);
+		*result = fail_result(ctx, str);
+
+		return;
+	}
+
+	for (i = 1; i <= list[0]; i++) {
+		vm_leaf(ctx, program, vm_child(program, insn, list[i]), str, result);
+
+		if (result->status == PCO_OK)
+			break;
+	}
+}
+
+/* execute instruction without stack frame if it is leaf, flat branch or sequence,
+ * or branch with only leaf alternatives for str, returns false if it needs frame */
+static VM_INLINE bool vm_flat(struct pco_ctx* ctx, const struct vm_program* program, const struct vm_insn* insn,
+		const char* str, struct pco_result* result)
+{
+	const struct vm_insn* child;
+	struct pco_result_array* arr;
+	const unsigned* list;
+	const char* rest = str;
+	unsigned i;
+
+	if (insn->leaf) {
+		vm_leaf(ctx, program, insn, str, result);
+
+		return true;
+	}
+
+	if (insn->op == OP_SEQUENCE && insn->flat) {
+		arr = create_arr(ctx, insn->count);
+
+		for (i = 0; i < insn->count; i++) {
+			child = vm_child(program, insn, i);
+
+			if (child->leaf)
+				vm_leaf(ctx, program, child, rest, result);
+			else
+				vm_choice(ctx, program, child, branch_list(ctx, child->arg.table, rest), rest, result);
+
+			if (result->status != PCO_OK)
+				return true;
+
+			rest = result->rest;
+			add_to_arr(ctx, arr, result->data.result);
+		}
+
+		*result = arr_result(arr, rest);
+
+		return true;
+	}
+
+	if (insn->op != OP_BRANCH)
+		return false;
+
+	list = branch_list(ctx, insn->arg.table, str);
+
+	if (!insn->flat)
+		for (i = 1; i <= list[0]; i++)
+			if (!vm_child(program, insn, list[i])->leaf)
+				return false;
+
+	vm_choice(ctx, program, insn, list, str, result);
+
+	return true;
+}
+
+/* results array for instruction frame */
+static struct pco_result_array* vm_arr(struct pco_ctx* ctx, const struct vm_insn* insn)
+{
+	switch (insn->op) {
+	case OP_REPEAT:
+	case OP_NOT_EMPTY:
+	case OP_SEQUENCE:
+		return create_arr(ctx, insn->count);
+
+	default:
+		return NULL;
+	}
+}
+
+/* execute compiled parser on str */
+static struct pco_result vm_parser(struct pco_ctx* ctx, struct vm_program* program, const char* str)
+{
+	struct vm_frame small[VM_STACK_SIZE];
+	struct vm_frame* stack = small;
+	unsigned capacity      = VM_STACK_SIZE;
+	unsigned top           = 0;
+	bool ret               = false;	/* child returned result */
+	const struct vm_insn* next;
+	struct pco_result result;
+
+	if (vm_flat(ctx, program, program->code, str, &result))
+		return result;
+
+	next = program->code;
+	goto frame;
+
+	for (;;) {
+		struct vm_frame* frame     = &stack[top];
+		const struct vm_insn* insn = frame->insn;
+		struct pco_result_array* arr;
+		struct pco_memo_entry* entry;
+		const char* rest;
+
+		next = NULL;
+
+		switch (insn->op) {
+		case OP_CHAR:
+		case OP_STR:
+		case OP_CHARSET:
+		case OP_FILTER:
+		case OP_SPAN:
+		case OP_KEYWORDS:
+		case OP_INT64:
+		case OP_UINT64:
+		case OP_FLOAT:
+		case OP_CALL:
+			vm_leaf(ctx, program, insn, frame->str, &result);
+			goto pop;
+
+		case OP_REPEAT:
+		case OP_NOT_EMPTY:
+			next = &program->code[insn->child];
+			arr  = frame->arr;
+			rest = frame->rest;
+
+			if (ret)
+				goto repeat_next;
+
+			/* items are parsed with locals, frame is updated only before push */
+			while (vm_flat(ctx, program, next, rest, &result)) {
+			repeat_next:
+				if (result.status != PCO_OK && insn->op == OP_NOT_EMPTY && rest == frame->str) {
+					result = fail_result(ctx, frame->str);
+					goto pop;
+				}
+
+				if (result.status != PCO_OK) {
+					result = arr_result(arr, rest);
+					goto pop;
+				}
+
+				rest = result.rest;
+				add_to_arr(ctx, arr, result.data.result);
+			}
+
+			frame->rest = rest;
+			goto push;
+
+		case OP_FOLD:
+			next = &program->code[insn->child];
+
+			if (ret)
+				goto fold_next;
+
+			frame->acc  = insn->arg.fold->init;
+			frame->mark = fold_mark(ctx);
+
+			while (vm_flat(ctx, program, next, frame->rest, &result)) {
+			fold_next:
+				if (result.status != PCO_OK) {
+					fold_end(ctx, frame->mark);
+					result = fold_result(frame->acc, frame->rest);
+					goto pop;
+				}
+
+				frame->rest = result.rest;
+				frame->acc  = fold_step(ctx, insn->arg.fold->step, frame->acc, result.data.result, frame->mark);
+			}
+
+			goto push;
+
+		case OP_BRANCH:
+			if (ret) {
+				if (result.status == PCO_OK)
+					goto pop;
+
+				frame->i++;
+			} else {
+				frame->list = branch_list(ctx, insn->arg.table, frame->str);
+			}
+
+			for (; frame->i < frame->list[0]; frame->i++) {
+				next = vm_child(program, insn, frame->list[frame->i + 1]);
+
+				if (!vm_flat(ctx, program, next, frame->str, &result))
+					goto push;
+
+				if (result.status == PCO_OK)
+					goto pop;
+			}
+
+			if (frame->list[0] == 0) {
+				fail_set(ctx, frame->str, &insn->arg.table->expected);
+				result = fail_result(ctx, frame->str);
+			}
+
+			goto pop;
+
+		case OP_SEQUENCE:
+			if (ret)
+				goto sequence_next;
+
+			for (; frame->i < insn->count; frame->i++) {
+				next = vm_child(program, insn, frame->i);
+
+				if (!vm_flat(ctx, program, next, frame->rest, &result))
+					goto push;
+
+			sequence_next:
+				if (result.status != PCO_OK)
+					goto pop;
+
+				frame->rest = result.rest;
+				add_to_arr(ctx, frame->arr, result.data.result);
+			}
+
+			result = arr_result(frame->arr, frame->rest);
+			goto pop;
+
+		case OP_MAP:
+			if (ret) {
+				map_apply(ctx, insn->arg.maps, insn->count, &result);
+
+				goto pop;
+			}
+
+			next = &program->code[insn->child];
+			goto push;
+
+		case OP_MEMO:
+			if (ret)
+				goto memo_insert;
+
+			if ((entry = memo_find(&ctx->memo, insn, frame->str, ctx->discard != 0)) != NULL) {
+				result = entry->result;
+				goto pop;
+			}
+
+			next = &program->code[insn->child];
+
+			if (!vm_flat(ctx, program, next, frame->str, &result))
+				goto push;
+
+		memo_insert:
+			memo_insert(&ctx->memo, insn, frame->str, ctx->discard != 0, result);
+			goto pop;
+
+		case OP_SLICE:
+		case OP_SKIP:
+			if (ret)
+				goto slice_done;
+
+			ctx->discard++;
+			next = &program->code[insn->child];
+
+			if (!vm_flat(ctx, program, next, frame->str, &result))
+				goto push;
+
+		slice_done:
+			ctx->discard--;
+
+			if (result.status == PCO_OK)
+				result.data.result = insn->op == OP_SLICE ? slice_result(ctx, frame->str, result.rest) : NULL;
+
+			goto pop;
+		}
+
+	push:
+		str = frame->rest;
+
+		if (top + 1 == capacity) {
+			capacity *= 2;
+
+			if (stack == small) {
+				stack = PCO_MALLOC(capacity * sizeof(struct vm_frame));
+				memcpy(stack, small, sizeof(small));
+			} else
+				stack = PCO_REALLOC(stack, capacity * sizeof(struct vm_frame));
+		}
+
+		top++;
+
+	frame:
+		stack[top].insn = next;
+		stack[top].str  = str;
+		stack[top].rest = str;
+		stack[top].i    = 0;
+		stack[top].arr  = vm_arr(ctx, next);
+
+		ret = false;
+		continue;
+
+	pop:
+		if (top == 0)
+			break;
+
+		top--;
+		ret = true;
+	}
+
+	if (stack != small)
+		PCO_FREE(stack);
+
+	return result;
+}
+
+/* compiled parser and its instruction */
+struct vm_node {
+	struct pco_parser parser;	/* source parser */
+	unsigned insn;			/* instruction index */
+};
+
+/* compiler state */
+struct vm_compiler {
+	struct pco_ctx* ctx;		/* context for program */
+
+	struct vm_insn* code;		/* instructions */
+	unsigned size;			/* instructions count */
+	unsigned capacity;		/* allocated instructions */
+
+	unsigned* children;		/* children indexes */
+	unsigned children_size;		/* children indexes count */
+	unsigned children_capacity;	/* allocated children indexes */
+
+	struct vm_node* nodes;		/* hash table of compiled parsers */
+	unsigned nodes_size;		/* hash table size, power of 2 */
+};
+
+/* hash table slot for parser */
+static unsigned vm_node_slot(const struct vm_compiler* compiler, const struct pco_parser* parser)
+{
+	uint64_t hash = (uintptr_t) parser->data * 0x9e3779b97f4a7c15ull;
+	unsigned slot = (hash ^ (hash >> 32)) & (compiler->nodes_size - 1);
+
+	while (compiler->nodes[slot].parser.parser != NULL && (compiler->nodes[slot].parser.parser != parser->parser
+				|| compiler->nodes[slot].parser.data != parser->data))
+		slot = (slot + 1) & (compiler->nodes_size - 1);
+
+	return slot;
+}
+
+/* remember instruction of compiled parser */
+static void vm_add_node(struct vm_compiler* compiler, const struct pco_parser* parser, unsigned insn)
+{
+	unsigned i;
+
+	if (compiler->size * 2 > compiler->nodes_size) {
+		struct vm_node* old = compiler->nodes;
+		unsigned old_size   = compiler->nodes_size;
+
+		compiler->nodes_size = old_size * 2;
+		compiler->nodes      = PCO_CALLOC(compiler->nodes_size, sizeof(struct vm_node));
+
+		for (i = 0; i < old_size; i++)
+			if (old[i].parser.parser != NULL)
+				compiler->nodes[vm_node_slot(compiler, &old[i].parser)] = old[i];
+
+		PCO_FREE(old);
+	}
+
+	compiler->nodes[vm_node_slot(compiler, parser)] = (struct vm_node) {
+		.parser = *parser,
+		.insn   = insn,
+	};
+}
+
+/* reserve count children indexes, returns index of first */
+static unsigned vm_add_children(struct vm_compiler* compiler, unsigned count)
+{
+	unsigned first = compiler->children_size;
+
+	compiler->children_size += count;
+
+	if (compiler->children_size > compiler->children_capacity) {
+		compiler->children_capacity = compiler->children_size * 2;
+		compiler->children          = PCO_REALLOC(compiler->children, compiler->children_capacity * sizeof(unsigned));
+	}
+
+	return first;
+}
+
+/* compile parser, returns its instruction index */
+static unsigned vm_compile(struct vm_compiler* compiler, struct pco_parser parser)
+{
+	struct vm_insn insn = {
+		.op = OP_CALL,
+	};
+	struct pco_parser* children;
+	struct vm_node* node;
+	unsigned index, count, i;
+
+	while (parser.parser == (pco_parser_f) ptr_parser || parser.parser == (pco_parser_f) name_parser) {
+		parser = *(struct pco_parser*) parser.data;
+
+		assert(parser.parser != NULL && "pco_ptr target must be defined before pco_compile");
+	}
+
+	node = &compiler->nodes[vm_node_slot(compiler, &parser)];
+	if (node->parser.parser != NULL)
+		return node->insn;
+
+	if (compiler->size == compiler->capacity) {
+		compiler->capacity *= 2;
+		compiler->code      = PCO_REALLOC(compiler->code, compiler->capacity * sizeof(struct vm_insn));
+	}
+
+	index = compiler->size++;
+	vm_add_node(compiler, &parser, index);
+
+	if (parser.parser == (pco_parser_f) char_parser) {
+		insn.op    = OP_CHAR;
+		insn.arg.c = *(char*) parser.data;
+	} else if (parser.parser == (pco_parser_f) str_parser) {
+		insn.op      = OP_STR;
+		insn.arg.str = parser.data;
+	} else if (parser.parser == (pco_parser_f) filter_parser) {
+		insn.op         = OP_FILTER;
+		insn.arg.filter = parser.data;
+	} else if (parser.parser == (pco_parser_f) charset_parser) {
+		insn.op      = OP_CHARSET;
+		insn.arg.set = parser.data;
+	} else if (parser.parser == (pco_parser_f) span_parser) {
+		insn.op       = OP_SPAN;
+		insn.arg.span = parser.data;
+	} else if (parser.parser == (pco_parser_f) keywords_parser) {
+		insn.op           = OP_KEYWORDS;
+		insn.arg.keywords = parser.data;
+	} else if (parser.parser == (pco_parser_f) int64_parser || parser.parser == (pco_parser_f) uint64_parser) {
+		insn.op          = parser.parser == (pco_parser_f) int64_parser ? OP_INT64 : OP_UINT64;
+		insn.arg.integer = parser.data;
+	} else if (parser.parser == (pco_parser_f) float_parser) {
+		insn.op = OP_FLOAT;
+	} else if (parser.parser == (pco_parser_f) repeat_parser || parser.parser == (pco_parser_f) not_empty_repeat_parser) {
+		insn.op    = parser.parser == (pco_parser_f) repeat_parser ? OP_REPEAT : OP_NOT_EMPTY;
+		insn.count = ((struct repeat_data*) parser.data)->hint;
+		insn.child = vm_compile(compiler, ((struct repeat_data*) parser.data)->parser);
+	} else if (parser.parser == (pco_parser_f) fold_parser) {
+		insn.op       = OP_FOLD;
+		insn.arg.fold = parser.data;
+		insn.child    = vm_compile(compiler, ((struct fold_data*) parser.data)->parser);
+	} else if (parser.parser == (pco_parser_f) memo_parser) {
+		insn.op    = OP_MEMO;
+		insn.child = vm_compile(compiler, *(struct pco_parser*) parser.data);
+	} else if (parser.parser == (pco_parser_f) slice_parser || parser.parser == (pco_parser_f) skip_parser) {
+		insn.op    = parser.parser == (pco_parser_f) slice_parser ? OP_SLICE : OP_SKIP;
+		insn.child = vm_compile(compiler, *(struct pco_parser*) parser.data);
+	} else if (parser.parser == (pco_parser_f) map_parser) {
+		insn.op       = OP_MAP;
+		insn.count    = ((struct map_data*) parser.data)->count;
+		insn.arg.maps = ((struct map_data*) parser.data)->maps;
+		insn.child    = vm_compile(compiler, ((struct map_data*) parser.data)->parser);
+	} else if (parser.parser == (pco_parser_f) branch_parser || parser.parser == (pco_parser_f) sequence_parser) {
+		insn.op  = OP_SEQUENCE;
+		children = parser_children(parser, &count);
+
+		if (parser.parser == (pco_parser_f) branch_parser) {
+			struct first_set first;
+
+			insn.op        = OP_BRANCH;
+			insn.arg.table = &((struct branch_data*) parser.data)->table;
+
+			/* pco_ptr targets are known now, so table may be more precise */
+			if (!((struct branch_data*) parser.data)->first.exact) {
+				insn.arg.table = size_alloc(&compiler->ctx->grammar, struct branch_table);
+				branch_table_create(&compiler->ctx->grammar, insn.arg.table, &first, children,
+						count, FIRST_DEPTH);
+			}
+		}
+
+		insn.count = count;
+		insn.child = vm_add_children(compiler, count);
+
+		for (i = 0; i < count; i++) {
+			unsigned child = vm_compile(compiler, children[i]);
+
+			compiler->children[insn.child + i] = child;
+		}
+	} else {
+		insn.arg.parser  = size_alloc(&compiler->ctx->grammar, struct pco_parser);
+		*insn.arg.parser = parser;
+	}
+
+	compiler->code[index] = insn;
+
+	return index;
+}
+
+/* instruction without children */
+static bool vm_is_leaf(const struct vm_insn* insn)
+{
+	switch (insn->op) {
+	case OP_CHAR:
+	case OP_STR:
+	case OP_CHARSET:
+	case OP_FILTER:
+	case OP_SPAN:
+	case OP_KEYWORDS:
+	case OP_INT64:
+	case OP_UINT64:
+	case OP_FLOAT:
+	case OP_CALL:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* mark instructions that run without stack frame */
+static void vm_flatten(struct vm_compiler* compiler)
+{
+	const struct vm_insn* leaf;
+	struct vm_insn* insn;
+	unsigned i, j;
+
+	for (i = 0; i < compiler->size; i++) {
+		insn = &compiler->code[i];
+		leaf = insn;
+
+		for (j = 0; j < VM_CHAIN && (leaf->op == OP_MAP || leaf->op == OP_SLICE || leaf->op == OP_SKIP); j++)
+			leaf = &compiler->code[leaf->child];
+
+		insn->leaf = vm_is_leaf(leaf);
+	}
+
+	/* branches first, sequences of them are flat too */
+	for (i = 0; i < compiler->size; i++) {
+		insn = &compiler->code[i];
+
+		if (insn->op != OP_BRANCH)
+			continue;
+
+		insn->flat = true;
+
+		for (j = 0; j < insn->count; j++)
+			insn->flat &= compiler->code[compiler->children[insn->child + j]].leaf;
+	}
+
+	for (i = 0; i < compiler->size; i++) {
+		insn = &compiler->code[i];
+
+		if (insn->op != OP_SEQUENCE)
+			continue;
+
+		insn->flat = true;
+
+		for (j = 0; j < insn->count; j++) {
+			leaf        = &compiler->code[compiler->children[insn->child + j]];
+			insn->flat &= leaf->leaf || (leaf->op == OP_BRANCH && leaf->flat);
+		}
+	}
+}
+
+/* compile parser to bytecode, returned parser gives same results, it runs without
+ * recursion and is faster on deeply nested grammars but about as fast as parser on
+ * flat ones, parsers referenced by pco_ptr must be already defined */
+struct pco_parser pco_compile(struct pco_ctx* ctx, struct pco_parser parser)
+{
+	struct vm_program* program  = size_alloc(&ctx->grammar, struct vm_program);
+	struct vm_compiler compiler = {
+		.ctx        = ctx,
+		.code       = PCO_MALLOC(16 * sizeof(struct vm_insn)),
+		.capacity   = 16,
+		.nodes      = PCO_CALLOC(16, sizeof(struct vm_node)),
+		.nodes_size = 16,
+	};
+
+	vm_compile(&compiler, parser);
+	vm_flatten(&compiler);
+
+	program->code     = grammar_alloc(&ctx->grammar, compiler.size * sizeof(struct vm_insn));
+	program->children = grammar_alloc(&ctx->grammar, compiler.children_size * sizeof(unsigned));
+
+	memcpy(program->code, compiler.code, compiler.size * sizeof(struct vm_insn));
+
+	if (compiler.children_size != 0)
+		memcpy(program->children, compiler.children, compiler.children_size * sizeof(unsigned));
+
+	PCO_FREE(compiler.code);
+	PCO_FREE(compiler.children);
+	PCO_FREE(compiler.nodes);
+
+	return (struct pco_parser) {
+		.parser = (pco_parser_f) vm_parser,
+		.data   = program,
+	};
+}
+
+/* run parser on len bytes from buf */
+struct pco_result pco_run_parser_n(struct pco_ctx* ctx, const struct pco_parser* parser, const char* buf, size_t len)
+{
+	const char* end = ctx->end;
+	ctx->end        = buf + len;
+	ctx->no_memory  = false;
+
+	memo_clear(&ctx->memo);
+	fail_start(ctx, buf);
+
+	struct pco_result result = call_parser(ctx, parser, buf);
+
+	if (ctx->no_memory) {
+		result = no_memory_result(buf);
+
+		goto done;
+	}
+
+	if (result.status == PCO_OK && result.rest == ctx->end)
+		goto done;
+
+	/* parser stopped before end, so end was excepted there */
+	if (result.status == PCO_OK && result.rest >= ctx->fail) {
+		if (result.rest > ctx->fail)
+			fail_start(ctx, result.rest);
+
+		ctx->expected_end = true;
+	}
+
+	result = furthest_result(ctx);
+
+done:
+	ctx->end = end;
+
+	return result;
+}
+
+/* count new lines from str to end */
+static size_t lines_scalar(const char* str, const char* end)
+{
+	size_t lines = 0;
+
+	for (; str != end; str++)
+		lines += *str == '\n';
+
+	return lines;
+}
+
+#ifdef SPAN_X86
+/* sse2 new lines counter, checks 16 characters at once */
+__attribute__((target("sse2,popcnt")))
+static size_t lines_sse2(const char* str, const char* end)
+{
+	size_t lines = 0;
+
+	while (end - str >= 16) {
+		__m128i chars = _mm_loadu_si128((const __m128i*) str);
+
+		lines += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\n'))));
+		str   += 16;
+	}
+
+	return lines + lines_scalar(str, end);
+}
+#endif
+
+/* get line and column of pos in input starting at begin, both from 1 */
+void pco_position(const char* begin, const char* pos, size_t* line, size_t* column)
+{
+	const char* c;
+
+	for (c = pos; c != begin && c[-1] != '\n'; c--);
+
+	*column = pos - c + 1;
+
+#ifdef SPAN_X86
+	if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+		*line = lines_sse2(begin, c) + 1;
+
+		return;
+	}
+#endif
+
+	*line = lines_scalar(begin, c) + 1;
+}
+
+/* run parser on str */
+struct pco_result pco_run_parser(struct pco_ctx* ctx, const struct pco_parser* parser, const char* str)
+{
+	return pco_run_parser_n(ctx, parser, str, strlen(str));
+}
+
+/* run parser on file mapped to memory */
+struct pco_result pco_run_parser_file(struct pco_ctx* ctx, const struct pco_parser* parser, const char* path)
+{
+	struct stat st;
+	void* map;
+	FILE* file;
+
+	struct pco_result result = {
+		.status = PCO_IO_ERROR,
+		.rest   = NULL,
+	};
+
+	file_unmap(ctx);
+
+	if ((file = fopen(path, "rb")) == NULL)
+		return result;
+
+	if (fstat(fileno(file), &st) < 0)
+		goto fail;
+
+	if (st.st_size == 0) {
+		fclose(file);
+
+		return pco_run_parser_n(ctx, parser, "", 0);
+	}
+
+	if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0)) == MAP_FAILED)
+		goto fail;
+
+	fclose(file);
+
+#ifdef MADV_SEQUENTIAL
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	ctx->file      = map;
+	ctx->file_size = st.st_size;
+
+	return pco_run_parser_n(ctx, parser, ctx->file, ctx->file_size);
+
+fail:
+	fclose(file);
+
+	return result;
+}
+
+/* grow stream window so it can hold one read of chunk or want bytes, keeps unparsed input */
+static bool stream_grow(struct pco_stream* stream, char** buf, size_t* size, size_t* start, size_t* len, size_t want)
+{
+	char* new_buf;
+
+	if (want < stream->chunk)
+		want = stream->chunk;
+
+	if (*start != 0) {
+		memmove(*buf, *buf + *start, *len - *start);
+		*len   -= *start;
+		*start  = 0;
+	}
+
+	if (*size - *len >= want)
+		return true;
+
+	if ((new_buf = PCO_REALLOC(*buf, *len + want)) == NULL)
+		return false;
+
+	*buf  = new_buf;
+	*size = *len + want;
+
+	if (*size > stream->peak)
+		stream->peak = *size;
+
+	return true;
+}
+
+/* run parser on input from stream item by item, keeps only input of current item in memory */
+struct pco_result pco_run_parser_stream(struct pco_ctx* ctx, const struct pco_parser* parser, struct pco_stream* stream)
+{
+	struct pco_mark results = arena_mark(&ctx->results);
+	struct pco_mark folds   = arena_mark(&ctx->folds);
+	const char* end         = ctx->end;
+	char* buf               = NULL;
+	size_t size             = 0;
+	size_t start            = 0;
+	size_t len              = 0;
+	size_t want             = 0;	/* new bytes to read before item is parsed again */
+	bool eof                = false;
+	long n;
+
+	struct pco_result result = {
+		.status = PCO_OK,
+		.rest   = NULL,
+	};
+
+	if (stream->chunk == 0)
+		stream->chunk = PCO_STREAM_CHUNK;
+
+	stream->committed = 0;
+	stream->peak      = 0;
+	stream->fail      = 0;
+	ctx->no_memory    = false;
+
+	for (;;) {
+		if (start == len && eof)
+			break;
+
+		if (start != len && want == 0) {
+			ctx->end     = buf + len;
+			ctx->hit_end = false;
+			memo_clear(&ctx->memo);
+			fail_start(ctx, buf + start);
+
+			result = call_parser(ctx, parser, buf + start);
+
+			if (ctx->no_memory) {
+				result       = no_memory_result(buf + start);
+				stream->fail = stream->committed;
+
+				goto stop;
+			}
+
+			if (!ctx->hit_end || eof) {
+				if (result.status != PCO_OK || result.rest == buf + start) {
+					result       = furthest_result(ctx);
+					stream->fail = stream->committed + (ctx->fail - (buf + start));
+
+					goto stop;
+				}
+
+				n = result.rest - (buf + start);
+
+				if (stream->item != NULL && !stream->item(ctx, stream, &result))
+					goto stop;
+
+				start             += n;
+				stream->committed += n;
+				arena_rewind(&ctx->results, results);
+				arena_rewind(&ctx->folds, folds);
+
+				continue;
+			}
+
+			/* item is parsed again only when its input at least doubles, so long
+			 * items cost linear time in their length */
+			want = len - start;
+			arena_rewind(&ctx->results, results);
+			arena_rewind(&ctx->folds, folds);
+		}
+
+		if (!stream_grow(stream, &buf, &size, &start, &len, want))
+			goto io_error;
+
+		while ((n = stream->read(stream->data, buf + len, size - len)) < 0 && errno == EINTR);
+
+		if (n < 0)
+			goto io_error;
+
+		if (n == 0)
+			eof = true;
+
+		len  += n;
+		want  = eof || (size_t) n >= want ? 0 : want - n;
+	}
+
+	result.status = PCO_OK;
+	goto stop;
+
+io_error:
+	result.status = PCO_IO_ERROR;
+
+stop:
+	/* results and input of items are freed, memo keys point to input */
+	arena_rewind(&ctx->results, results);
+	arena_rewind(&ctx->folds, folds);
+	memo_clear(&ctx->memo);
+
+	if (result.status != PCO_UNEXEPTED)
+		result.data.result = NULL;
+
+	result.rest = NULL;
+	ctx->end    = end;
+	ctx->fail   = NULL;
+	PCO_FREE(buf);
+
+	return result;
+}
+
+/* read function for pco_run_parser_fd */
+static long fd_read(int* fd, char* buf, size_t size)
+{
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len  = size,
+	};
+
+	return readv(*fd, &iov, 1);
+}
+
+/* run parser on input from file descriptor item by item */
+struct pco_result pco_run_parser_fd(struct pco_ctx* ctx, const struct pco_parser* parser, int fd, pco_item_f item, void* data)
+{
+	struct pco_stream stream = {
+		.read      = (pco_read_f) fd_read,
+		.data      = &fd,
+		.item      = item,
+		.item_data = data,
+	};
+
+	return pco_run_parser_stream(ctx, parser, &stream);
+}
+
+/* part of input for pco_run_parser_parallel */
+struct parallel_part {
+	const char* str;			/* first character */
+	const char* end;			/* end of part */
+	struct pco_result_array* results;	/* item results */
+	struct pco_result error;		/* furthest failure in failed item */
+	struct pco_charset expected;		/* characters excepted at failure */
+	bool expected_end;			/* end of input excepted at failure */
+};
+
+/* shared state of pco_run_parser_parallel */
+struct parallel_data {
+	const struct pco_parser* parser;	/* parser for one item */
+	struct parallel_part* parts;		/* input parts */
+	unsigned count;				/* parts count */
+	unsigned next;				/* next part to parse, taken atomically */
+};
+
+/* worker of pco_run_parser_parallel */
+struct parallel_worker {
+	struct parallel_data* data;	/* shared state */
+	struct pco_ctx ctx;		/* parse session for worker results */
+	pthread_t thread;		/* worker thread */
+};
+
+/* parse one part of input item by item */
+static void parallel_part(struct pco_ctx* ctx, const struct pco_parser* parser, struct parallel_part* part)
+{
+	const char* str = part->str;
+	struct pco_result result;
+
+	ctx->end = part->end;
+	memo_clear(&ctx->memo);
+
+	ctx->no_memory     = false;
+	part->results      = create_arr(ctx, ARR_CAPACITY);
+	part->error.status = PCO_OK;
+
+	while (str != part->end) {
+		fail_start(ctx, str);
+		result = call_parser(ctx, parser, str);
+
+		if (ctx->no_memory)
+			break;
+
+		if (result.status != PCO_OK || result.rest == str) {
+			part->error        = furthest_result(ctx);
+			part->expected     = ctx->expected;
+			part->expected_end = ctx->expected_end;
+
+			return;
+		}
+
+		add_to_arr(ctx, part->results, result.data.result);
+		str = result.rest;
+	}
+
+	if (ctx->no_memory)
+		part->error = no_memory_result(str);
+}
+
+/* thread function for parallel worker, parses parts while there are any */
+static void* parallel_thread(struct parallel_worker* worker)
+{
+	struct parallel_data* data = worker->data;
+	unsigned i;
+
+	while ((i = __atomic_fetch_add(&data->next, 1, __ATOMIC_RELAXED)) < data->count)
+		parallel_part(&worker->ctx, data->parser, &data->parts[i]);
+
+	return NULL;
+}
+
+/* run parser on records from len bytes at buf in threads count threads */
+struct pco_result pco_run_parser_parallel(struct pco_ctx* ctx, const struct pco_parser* parser, const char* buf, size_t len,
+		char delim, unsigned threads)
+{
+	struct parallel_worker* workers = NULL;
+	struct pco_result_array* arr;
+	struct parallel_data data;
+	const char* str;
+	const char* end;
+	unsigned started = 0;
+	unsigned size    = 0;
+	unsigned i;
+
+	struct pco_result result = {
+		.status = PCO_OK,
+		.rest   = buf + len,
+	};
+
+	if (threads == 0)
+		threads = cpu_count();
+
+	data = (struct parallel_data) {
+		.parser = parser,
+		.count  = threads * PARALLEL_PARTS,
+		.next   = 0,
+	};
+
+	if (len / PARALLEL_MIN_PART + 1 < data.count)
+		data.count = len / PARALLEL_MIN_PART + 1;
+
+	if (threads > data.count)
+		threads = data.count;
+
+	data.parts = PCO_MALLOC(data.count * sizeof(struct parallel_part));
+	workers    = PCO_MALLOC(threads * sizeof(struct parallel_worker));
+
+	if (data.parts == NULL || workers == NULL) {
+		result = no_memory_result(buf);
+
+		goto done;
+	}
+
+	/* split input after delimiters near equal offsets */
+	for (i = 0, str = buf; i < data.count; i++) {
+		end = buf + len * (i + 1) / data.count;
+
+		if (end < str)
+			end = str;
+
+		if (i + 1 == data.count || (end = memchr(end, delim, buf + len - end)) == NULL)
+			end = buf + len;
+		else
+			end++;
+
+		data.parts[i] = (struct parallel_part) {
+			.str = str,
+			.end = end,
+		};
+
+		str = end;
+	}
+
+	for (started = 0; started < threads; started++) {
+		workers[started].data = &data;
+		pco_create_ctx(&workers[started].ctx);
+
+		if (started == 0)
+			continue;
+
+		if (pthread_create(&workers[started].thread, NULL, (void* (*)(void*)) parallel_thread, &workers[started])) {
+			pco_free_ctx(&workers[started].ctx);
+			break;
+		}
+	}
+
+	/* calling thread is worker too */
+	parallel_thread(&workers[0]);
+
+	for (i = 1; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < data.count; i++) {
+		if (data.parts[i].error.status != PCO_OK) {
+			result            = data.parts[i].error;
+			ctx->fail         = result.rest;
+			ctx->expected     = data.parts[i].expected;
+			ctx->expected_end = data.parts[i].expected_end;
+			ctx->overflow     = result.status == PCO_OVERFLOW;
+
+			goto done;
+		}
+
+		if (data.parts[i].results != NULL)
+			size += data.parts[i].results->size;
+	}
+
+	ctx->no_memory = false;
+
+	if ((arr = create_arr(ctx, size)) == NULL) {
+		if (ctx->no_memory)
+			result = no_memory_result(buf);
+
+		goto done;
+	}
+
+	for (i = 0; i < data.count; i++) {
+		if (data.parts[i].results == NULL || data.parts[i].results->size == 0)
+			continue;
+
+		memcpy(arr->results + arr->size, data.parts[i].results->results,
+				data.parts[i].results->size * sizeof(void*));
+		arr->size += data.parts[i].results->size;
+	}
+
+	result.data.result = arr;
+
+done:
+	/* keep results of items in ctx */
+	for (i = 0; i < started; i++) {
+		arena_splice(&ctx->results, &workers[i].ctx.results);
+		arena_splice(&ctx->folds, &workers[i].ctx.folds);
+		pco_free_ctx(&workers[i].ctx);
+	}
+
+	PCO_FREE(data.parts);
+	PCO_FREE(workers);
+
+	return result;
+}
+
+/* name of parser kind for profile and keys of generated parser externs */
+static const char* parser_kind(pco_parser_f parser)
+{
+	static const struct {
+		pco_parser_f parser;
+		const char* name;
+	} kinds[] = {
+		{ (pco_parser_f) char_parser,			"char" },
+		{ (pco_parser_f) str_parser,			"str" },
+		{ (pco_parser_f) keywords_parser,		"keywords" },
+		{ (pco_parser_f) int64_parser,			"int64" },
+		{ (pco_parser_f) uint64_parser,			"uint64" },
+		{ (pco_parser_f) float_parser,			"float" },
+		{ (pco_parser_f) filter_parser,			"filter" },
+		{ (pco_parser_f) charset_parser,		"charset" },
+		{ (pco_parser_f) span_parser,			"charset_filter" },
+		{ (pco_parser_f) repeat_parser,			"repeat" },
+		{ (pco_parser_f) not_empty_repeat_parser,	"not_empty_repeat" },
+		{ (pco_parser_f) fold_parser,			"fold" },
+		{ (pco_parser_f) branch_parser,			"branch" },
+		{ (pco_parser_f) sequence_parser,		"sequence" },
+		{ (pco_parser_f) map_parser,			"map" },
+		{ (pco_parser_f) check_parser,			"check" },
+		{ (pco_parser_f) slice_parser,			"slice" },
+		{ (pco_parser_f) skip_parser,			"skip" },
+		{ (pco_parser_f) ptr_parser,			"ptr" },
+		{ (pco_parser_f) memo_parser,			"memo" },
+		{ (pco_parser_f) vm_parser,			"compiled" },
+	};
+	unsigned i;
+
+	for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+		if (kinds[i].parser == parser)
+			return kinds[i].name;
+
+	return "custom";
+}
+
+#ifdef PCO_PROFILE
+/* order of profile entries, most time first */
+static int profile_compare(const void* a, const void* b)
+{
+	const struct pco_profile_entry* x = a;
+	const struct pco_profile_entry* y = b;
+
+	if (x->time != y->time)
+		return x->time < y->time ? 1 : -1;
+
+	return x->calls < y->calls ? 1 : x->calls > y->calls ? -1 : 0;
+}
+#endif
+
+/* print profile counters of parsers run with ctx to file */
+void pco_profile_dump(struct pco_ctx* ctx, FILE* file)
+{
+#ifdef PCO_PROFILE
+	struct pco_profile_entry* entries;
+	size_t count = 0;
+	size_t i;
+
+	if ((entries = PCO_MALLOC(ctx->profile.count * sizeof(struct pco_profile_entry) + 1)) == NULL)
+		return;
+
+	for (i = 0; i < ctx->profile.size; i++)
+		if (ctx->profile.entries[i].parser != NULL)
+			entries[count++] = ctx->profile.entries[i];
+
+	qsort(entries, count, sizeof(struct pco_profile_entry), profile_compare);
+
+	fprintf(file, "name\tkind\tnode\tcalls\tok\tfail\tbytes\ttime_ms\n");
+
+	for (i = 0; i < count; i++)
+		fprintf(file, "%s\t%s\t%p\t%llu\t%llu\t%llu\t%llu\t%.3f\n", entries[i].name != NULL ? entries[i].name : "-",
+				parser_kind(entries[i].parser), entries[i].data, entries[i].calls, entries[i].ok,
+				entries[i].fail, entries[i].bytes, entries[i].time / 1e6);
+
+	PCO_FREE(entries);
+#endif
+}
+
+/* reset profile counters in ctx */
+void pco_profile_reset(struct pco_ctx* ctx)
+{
+#ifdef PCO_PROFILE
+	PCO_FREE(ctx->profile.entries);
+
+	ctx->profile = (struct pco_profile) {
+		.entries = NULL,
+		.size    = 0,
+		.count   = 0,
+	};
+#endif
+}
+
+/* allocate size bytes for parse results, returns NULL if memory ends */
+void* pco_gen_alloc(struct pco_ctx* ctx, size_t size)
+{
+	return result_alloc(ctx, size);
+}
+
+/* make array for count results, returns NULL if results are discarded */
+struct pco_result_array* pco_gen_array(struct pco_ctx* ctx, unsigned capacity)
+{
+	return create_arr(ctx, capacity);
+}
+
+/* add result to array made by pco_gen_array */
+void pco_gen_add(struct pco_ctx* ctx, struct pco_result_array* arr, void* data)
+{
+	add_to_arr(ctx, arr, data);
+}
+
+/* make result of span parser from characters from str to rest */
+struct pco_result pco_gen_span(struct pco_ctx* ctx, const char* str, const char* rest)
+{
+	return span_result(ctx, str, rest);
+}
+
+/* start fold, returns position of its first item results */
+struct pco_mark pco_gen_mark(struct pco_ctx* ctx)
+{
+	return fold_mark(ctx);
+}
+
+/* add item to accumulator with step and free results made since mark */
+void* pco_gen_fold(struct pco_ctx* ctx, pco_fold_f step, void* acc, void* item, struct pco_mark mark)
+{
+	return fold_step(ctx, step, acc, item, mark);
+}
+
+/* free results of last item and finish fold started at mark */
+void pco_gen_rewind(struct pco_ctx* ctx, struct pco_mark mark)
+{
+	fold_end(ctx, mark);
+}
+
+/* make result of slice parser for input from str to rest */
+void* pco_gen_slice(struct pco_ctx* ctx, const char* str, const char* rest)
+{
+	return slice_result(ctx, str, rest);
+}
+
+/* remember that characters from set were excepted at pos */
+void pco_gen_fail(struct pco_ctx* ctx, const char* pos, const struct pco_charset* set)
+{
+	fail_set(ctx, pos, set);
+}
+
+/* remember first character of len bytes at lit not matched by input at str */
+void pco_gen_fail_str(struct pco_ctx* ctx, const char* lit, size_t len, const char* str)
+{
+	str_fail(ctx, lit, len, str);
+}
+
+/* result for unexepted input at str */
+struct pco_result pco_gen_fail_result(const struct pco_ctx* ctx, const char* str)
+{
+	return fail_result(ctx, str);
+}
+
+/* remember that number at pos does not fit in its type */
+void pco_gen_fail_overflow(struct pco_ctx* ctx, const char* pos)
+{
+	fail_overflow(ctx, pos);
+}
+
+/* convert json number without sign from str to rest, used when fast path is not exact */
+double pco_gen_float(struct pco_ctx* ctx, const char* str, const char* rest)
+{
+	return float_slow(ctx, str, rest);
+}
+
+/* cached result of memo node key at str, NULL if not cached */
+const struct pco_result* pco_gen_memo_find(struct pco_ctx* ctx, const void* key, const char* str)
+{
+	struct pco_memo_entry* entry = memo_find(&ctx->memo, key, str, ctx->discard != 0);
+
+	return entry != NULL ? &entry->result : NULL;
+}
+
+/* cache result of memo node key at str */
+void pco_gen_memo_insert(struct pco_ctx* ctx, const void* key, const char* str, struct pco_result result)
+{
+	memo_insert(&ctx->memo, key, str, ctx->discard != 0, result);
+}
+
+#define GEN_KEY		96	/* size of extern key with terminating zero */
+#define GEN_DEPTH	2	/* levels of children described by extern key */
+
+/* node of grammar in code generator */
+struct gen_node {
+	struct pco_parser parser;	/* parser, pco_ptr and pco_name are resolved */
+	unsigned ext;			/* index in externs table for maps, filters and opaque parsers */
+};
+
+/* slot of hash table of visited nodes */
+struct gen_slot {
+	struct pco_parser parser;	/* visited parser, NULL function in empty slot */
+	unsigned node;			/* node index */
+};
+
+/* map, fold, filter or opaque parser called through externs table */
+struct gen_extern {
+	char key[GEN_KEY];		/* kind and children of node, numbered if same key repeats */
+	unsigned index;			/* index in externs table of generated code */
+	bool bound;			/* found in table given to pco_generated */
+	union pco_extern value;		/* function or parser to call */
+};
+
+/* state of code generator, nodes are numbered in depth first order */
+struct gen {
+	struct pco_ctx* ctx;		/* context for rebuilt branch tables */
+	struct gen_node* nodes;		/* visited nodes */
+	unsigned count;			/* nodes count */
+	unsigned capacity;		/* allocated nodes */
+
+	struct gen_slot* slots;		/* hash table of visited nodes */
+	unsigned slots_size;		/* hash table size, power of 2 */
+
+	struct gen_extern* externs;	/* externs, in walk order until gen_keys */
+	unsigned externs_count;		/* externs count */
+	unsigned externs_capacity;	/* allocated externs */
+
+	FILE* file;			/* output */
+	const char* name;		/* name of generated parser */
+};
+
+/* follow pco_ptr and pco_name to real parser */
+static struct pco_parser gen_resolve(struct pco_parser parser)
+{
+	while (parser.parser == (pco_parser_f) ptr_parser || parser.parser == (pco_parser_f) name_parser) {
+		parser = *(struct pco_parser*) parser.data;
+
+		assert(parser.parser != NULL && "pco_ptr target must be defined before pco_generate");
+	}
+
+	return parser;
+}
+
+/* children of parser known to generator, none for leaves and opaque parsers */
+static struct pco_parser* gen_children(struct pco_parser parser, unsigned* count)
+{
+	*count = 1;
+
+	if (parser.parser == (pco_parser_f) repeat_parser || parser.parser == (pco_parser_f) not_empty_repeat_parser)
+		return &((struct repeat_data*) parser.data)->parser;
+
+	if (parser.parser == (pco_parser_f) memo_parser || parser.parser == (pco_parser_f) slice_parser
+			|| parser.parser == (pco_parser_f) skip_parser)
+		return parser.data;
+
+	if (parser.parser == (pco_parser_f) map_parser)
+		return &((struct map_data*) parser.data)->parser;
+
+	if (parser.parser == (pco_parser_f) fold_parser)
+		return &((struct fold_data*) parser.data)->parser;
+
+	if (parser.parser == (pco_parser_f) check_parser)
+		return &((struct check_data*) parser.data)->parser;
+
+	if (parser.parser == (pco_parser_f) branch_parser || parser.parser == (pco_parser_f) sequence_parser)
+		return parser_children(parser, count);
+
+	*count = 0;
+
+	return NULL;
+}
+
+/* check if parser is leaf printed as code by generator */
+static bool gen_builtin(struct pco_parser parser)
+{
+	return parser.parser == (pco_parser_f) char_parser || parser.parser == (pco_parser_f) str_parser
+		|| parser.parser == (pco_parser_f) charset_parser || parser.parser == (pco_parser_f) span_parser
+		|| parser.parser == (pco_parser_f) keywords_parser || parser.parser == (pco_parser_f) int64_parser
+		|| parser.parser == (pco_parser_f) uint64_parser || parser.parser == (pco_parser_f) float_parser;
+}
+
+/* slot of parser in hash table of visited nodes, empty slot if parser is not visited */
+static unsigned gen_slot(const struct gen* gen, struct pco_parser parser)
+{
+	uint64_t hash = (uintptr_t) parser.data * 0x9e3779b97f4a7c15ull;
+	unsigned slot = (hash ^ (hash >> 32)) & (gen->slots_size - 1);
+
+	while (gen->slots[slot].parser.parser != NULL && (gen->slots[slot].parser.parser != parser.parser
+				|| gen->slots[slot].parser.data != parser.data))
+		slot = (slot + 1) & (gen->slots_size - 1);
+
+	return slot;
+}
+
+/* index of visited node, nodes count if parser is not visited */
+static unsigned gen_find(const struct gen* gen, struct pco_parser parser)
+{
+	unsigned slot;
+
+	if (gen->slots_size == 0)
+		return gen->count;
+
+	slot = gen_slot(gen, gen_resolve(parser));
+
+	return gen->slots[slot].parser.parser != NULL ? gen->slots[slot].node : gen->count;
+}
+
+/* add node for resolved parser, its externs are added next */
+static struct gen_node* gen_add(struct gen* gen, struct pco_parser parser)
+{
+	unsigned i;
+
+	if ((gen->count + 1) * 2 > gen->slots_size) {
+		struct gen_slot* old = gen->slots;
+		unsigned old_size    = gen->slots_size;
+
+		gen->slots_size = old_size == 0 ? 128 : old_size * 2;
+		gen->slots      = PCO_CALLOC(gen->slots_size, sizeof(struct gen_slot));
+
+		for (i = 0; i < old_size; i++)
+			if (old[i].parser.parser != NULL)
+				gen->slots[gen_slot(gen, old[i].parser)] = old[i];
+
+		PCO_FREE(old);
+	}
+
+	if (gen->count == gen->capacity) {
+		gen->capacity = gen->capacity == 0 ? 64 : gen->capacity * 2;
+		gen->nodes    = PCO_REALLOC(gen->nodes, gen->capacity * sizeof(struct gen_node));
+	}
+
+	gen->slots[gen_slot(gen, parser)] = (struct gen_slot) {
+		.parser = parser,
+		.node   = gen->count,
+	};
+
+	gen->nodes[gen->count] = (struct gen_node) {
+		.parser = parser,
+		.ext    = gen->externs_count,
+	};
+
+	return &gen->nodes[gen->count++];
+}
+
+/* append description of parser and depth levels of its children to key of size bytes */
+static void gen_describe(char* key, size_t size, struct pco_parser parser, unsigned depth)
+{
+	size_t len = strlen(key);
+	struct pco_parser* children;
+	unsigned count, i;
+
+	if (len + 1 >= size)
+		return;
+
+	parser = gen_resolve(parser);
+
+	if (parser.parser == (pco_parser_f) char_parser) {
+		unsigned char c = *(unsigned char*) parser.data;
+
+		snprintf(key + len, size - len, c >= ' ' && c <= '~' ? "char '%c'" : "char %u", c);
+		return;
+	}
+
+	if (parser.parser == (pco_parser_f) str_parser) {
+		struct str_data* str = parser.data;
+
+		snprintf(key + len, size - len, "str \"%.*s\"", (int) str->len, str->str);
+		return;
+	}
+
+	snprintf(key + len, size - len, "%s", parser_kind(parser.parser));
+	children = gen_children(parser, &count);
+
+	if (depth == 0 || count == 0)
+		return;
+
+	/* children that do not fit are cut, room is left for ", ...)" */
+	for (i = 0; i < count; i++) {
+		len = strlen(key);
+		snprintf(key + len, size - len, "%s", i == 0 ? "(" : ", ");
+		gen_describe(key, size - 6, children[i], depth - 1);
+
+		if (strlen(key) + 1 >= size - 6) {
+			snprintf(key + len, size - len, "%s...", i == 0 ? "(" : ", ");
+			break;
+		}
+	}
+
+	len = strlen(key);
+	snprintf(key + len, size - len, ")");
+}
+
+/* add extern for node of parser, part numbers maps collapsed by pco_optimize */
+static void gen_extern(struct gen* gen, struct pco_parser parser, unsigned part, union pco_extern value)
+{
+	struct gen_extern* ext;
+	size_t len;
+
+	if (gen->externs_count == gen->externs_capacity) {
+		gen->externs_capacity = gen->externs_capacity == 0 ? 16 : gen->externs_capacity * 2;
+		gen->externs          = PCO_REALLOC(gen->externs, gen->externs_capacity * sizeof(struct gen_extern));
+	}
+
+	ext  = &gen->externs[gen->externs_count];
+	*ext = (struct gen_extern) {
+		.index = gen->externs_count++,
+		.bound = false,
+		.value = value,
+	};
+
+	/* room is left for part and number of repeated key */
+	gen_describe(ext->key, GEN_KEY - 16, parser, GEN_DEPTH);
+
+	if (part != 0) {
+		len = strlen(ext->key);
+		snprintf(ext->key + len, GEN_KEY - len, " [%u]", part);
+	}
+}
+
+/* visit parser and its children, assigns node and externs indexes */
+static void gen_walk(struct gen* gen, struct pco_parser parser)
+{
+	struct pco_parser* children;
+	unsigned count, i;
+
+	parser = gen_resolve(parser);
+
+	if (gen_find(gen, parser) != gen->count)
+		return;
+
+	gen_add(gen, parser);
+	children = gen_children(parser, &count);
+
+	/* maps, checks, filters and opaque parsers are called through externs table */
+	if (parser.parser == (pco_parser_f) map_parser) {
+		struct map_data* map = parser.data;
+
+		/* every map of collapsed maps has own extern */
+		for (i = 0; i < map->count; i++)
+			gen_extern(gen, parser, i, (union pco_extern) { .map = map->maps[i] });
+	} else if (parser.parser == (pco_parser_f) fold_parser) {
+		struct fold_data* fold = parser.data;
+
+		gen_extern(gen, parser, 0, (union pco_extern) { .fold = { .init = fold->init, .step = fold->step } });
+	} else if (parser.parser == (pco_parser_f) check_parser) {
+		gen_extern(gen, parser, 0, (union pco_extern) { .check = ((struct check_data*) parser.data)->check });
+	} else if (parser.parser == (pco_parser_f) filter_parser) {
+		gen_extern(gen, parser, 0, (union pco_extern) { .filter = ((struct filter_data*) parser.data)->filter });
+	} else if (count == 0 && !gen_builtin(parser)) {
+		gen_extern(gen, parser, 0, (union pco_extern) { .parser = parser });
+	}
+
+	for (i = 0; i < count; i++)
+		gen_walk(gen, children[i]);
+}
+
+/* order of externs by key, then by walk order */
+static int gen_key_compare(const void* a, const void* b)
+{
+	const struct gen_extern* x = a;
+	const struct gen_extern* y = b;
+	int diff                   = strcmp(x->key, y->key);
+
+	if (diff != 0)
+		return diff;
+
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* order of externs in walk order */
+static int gen_index_compare(const void* a, const void* b)
+{
+	const struct gen_extern* x = a;
+	const struct gen_extern* y = b;
+
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* compare key with key of extern, for bsearch */
+static int gen_key_find(const void* key, const void* ext)
+{
+	return strcmp(key, ((const struct gen_extern*) ext)->key);
+}
+
+/* number repeated keys in walk order so every extern has own key, sorts externs by key */
+static void gen_keys(struct gen* gen)
+{
+	unsigned first, i;
+	size_t len;
+
+	if (gen->externs_count == 0)
+		return;
+
+	qsort(gen->externs, gen->externs_count, sizeof(struct gen_extern), gen_key_compare);
+
+	for (first = 0, i = 1; i < gen->externs_count; i++) {
+		if (strcmp(gen->externs[i].key, gen->externs[first].key) != 0) {
+			first = i;
+			continue;
+		}
+
+		len = strlen(gen->externs[i].key);
+		snprintf(gen->externs[i].key + len, GEN_KEY - len, " #%u", i - first + 1);
+	}
+
+	qsort(gen->externs, gen->externs_count, sizeof(struct gen_extern), gen_key_compare);
+}
+
+/* print len bytes from str as string literal */
+static void gen_string(struct gen* gen, const char* str, size_t len)
+{
+	size_t i;
+
+	fputc('"', gen->file);
+
+	for (i = 0; i < len; i++) {
+		if (str[i] >= ' ' && str[i] <= '~' && str[i] != '"' && str[i] != '\\' && str[i] != '?')
+			fputc(str[i], gen->file);
+		else
+			fprintf(gen->file, "\\%03o", (unsigned char) str[i]);
+	}
+
+	fputc('"', gen->file);
+}
+
+/* print character set as initializer */
+static void gen_charset(struct gen* gen, const char* name, const unsigned char* chars)
+{
+	unsigned i;
+
+	fprintf(gen->file, "\tstatic const struct pco_charset %s = { {", name);
+
+	for (i = 0; i < 32; i++)
+		fprintf(gen->file, "%s0x%02x", i == 0 ? " " : i % 8 == 0 ? ",\n\t\t" : ", ", chars[i]);
+
+	fprintf(gen->file, " } };\n\n");
+}
+
+/* print failure returns for leaf parser expecting characters from set at str */
+static void gen_leaf_fail(struct gen* gen, const char* cond)
+{
+	fprintf(gen->file,
+		"\tif (str == ctx->end) {\n"
+		"\t\tctx->hit_end = true;\n"
+		"\t\tpco_gen_fail(ctx, str, &set);\n\n"
+		"\t\treturn (struct pco_result) { .status = PCO_END_OF_INPUT, .rest = str };\n"
+		"\t}\n\n"
+		"\tif (%s) {\n"
+		"\t\tpco_gen_fail(ctx, str, &set);\n\n"
+		"\t\treturn (struct pco_result) { .status = PCO_UNEXEPTED, .rest = str, .data.unexepted = *str };\n"
+		"\t}\n\n", cond);
+}
+
+/* print set of decimal digits expected by number parsers */
+static void gen_digits(struct gen* gen)
+{
+	struct pco_charset set;
+
+	pco_create_charset(&set);
+	pco_charset_add_range(&set, '0', '9');
+	gen_charset(gen, "set", set.chars);
+}
+
+/* print return from keywords trie node, matched keyword is longest one on path to node */
+static void gen_keyword_stop(struct gen* gen, const struct keywords_data* data, unsigned node, const unsigned* depth,
+		const unsigned* last, unsigned count, const char* indent)
+{
+	if (last[node] == count) {
+		fprintf(gen->file, "%spco_gen_fail(ctx, str + %u, &set%u);\n\n"
+			"%sreturn pco_gen_fail_result(ctx, str + %u);\n", indent, depth[node], node, indent, depth[node]);
+		return;
+	}
+
+	fprintf(gen->file, "%sreturn (struct pco_result) { .status = PCO_OK, .rest = str + %u, .data.result = (char*) ",
+			indent, depth[last[node]]);
+	gen_string(gen, data->nodes[last[node]].word, strlen(data->nodes[last[node]].word));
+	fprintf(gen->file, " };\n");
+}
+
+/* print function for pco_keywords, every trie node is label with switch on its edges,
+ * depth of node and keyword matched at it are constants */
+static void gen_keywords(struct gen* gen, const struct keywords_data* data)
+{
+	struct pco_charset expected;
+	unsigned count = 1;
+	unsigned* depth;
+	unsigned* last;
+	unsigned node, i, child;
+	char name[32];
+
+	/* nodes are numbered in breadth first order, children of every node follow it */
+	for (node = 0; node < count; node++)
+		count += data->nodes[node].count;
+
+	/* last is node of longest keyword on path to node, count if there is none */
+	depth    = PCO_MALLOC(count * sizeof(unsigned));
+	last     = PCO_MALLOC(count * sizeof(unsigned));
+	depth[0] = 0;
+	last[0]  = data->nodes[0].word != NULL ? 0 : count;
+
+	for (node = 0; node < count; node++) {
+		for (i = data->nodes[node].edges; i < data->nodes[node].edges + data->nodes[node].count; i++) {
+			child        = data->targets[i];
+			depth[child] = depth[node] + 1;
+			last[child]  = data->nodes[child].word != NULL ? child : last[node];
+		}
+	}
+
+	/* expected characters are needed only where no keyword was matched */
+	for (node = 0; node < count; node++) {
+		if (last[node] != count)
+			continue;
+
+		pco_create_charset(&expected);
+
+		for (i = data->nodes[node].edges; i < data->nodes[node].edges + data->nodes[node].count; i++)
+			pco_charset_add(&expected, data->labels[i]);
+
+		snprintf(name, sizeof(name), "set%u", node);
+		gen_charset(gen, name, expected.chars);
+	}
+
+	for (node = 0; node < count; node++) {
+		if (node != 0)
+			fprintf(gen->file, "k%u:\n", node);
+
+		fprintf(gen->file, "\tif (str + %u == ctx->end) {\n\t\tctx->hit_end = true;\n", depth[node]);
+		gen_keyword_stop(gen, data, node, depth, last, count, "\t\t");
+		fprintf(gen->file, "\t}\n\n");
+
+		if (data->nodes[node].count != 0) {
+			fprintf(gen->file, "\tswitch ((unsigned char) str[%u]) {\n", depth[node]);
+
+			for (i = data->nodes[node].edges; i < data->nodes[node].edges + data->nodes[node].count; i++)
+				fprintf(gen->file, "\tcase %u:\n\t\tgoto k%u;\n", data->labels[i], data->targets[i]);
+
+			fprintf(gen->file, "\t}\n\n");
+		}
+
+		gen_keyword_stop(gen, data, node, depth, last, count, "\t");
+
+		if (node + 1 != count)
+			fprintf(gen->file, "\n");
+	}
+
+	PCO_FREE(depth);
+	PCO_FREE(last);
+}
+
+/* print function for pco_int64 or pco_uint64, code is specialized for flags */
+static void gen_int(struct gen* gen, unsigned flags, bool sign)
+{
+	unsigned bases = flags & PCO_INT_PREFIX ? flags & (PCO_INT_HEX | PCO_INT_OCT | PCO_INT_BIN) : 0;
+
+	gen_digits(gen);
+	fprintf(gen->file,
+		"\tconst char* pos = str;\n"
+		"\tconst char* digits;\n"
+		"\tuint64_t value  = 0;\n"
+		"\tbool overflow   = false;\n"
+		"%s%s"
+		"\tunsigned digit;\n\n",
+		sign ? "\tbool negative   = false;\n" : "", bases != 0 ? "\tunsigned shift   = 0;\n" : "");
+
+	if (flags & PCO_INT_SIGN && sign) {
+		fprintf(gen->file,
+			"\tif (pos != ctx->end && (*pos == '+' || *pos == '-'))\n"
+			"\t\tnegative = *pos++ == '-';\n\n");
+	} else if (flags & PCO_INT_SIGN) {
+		fprintf(gen->file, "\tif (pos != ctx->end && *pos == '+')\n\t\tpos++;\n\n");
+	}
+
+	/* prefix needs at least one digit after it */
+	if (bases != 0) {
+		fprintf(gen->file,
+			"\tif (pos != ctx->end && *pos == '0') {\n"
+			"\t\tif (ctx->end - pos < 3) {\n"
+			"\t\t\tctx->hit_end = true;\n"
+			"\t\t} else {\n"
+			"\t\t\tswitch (pos[1] | 0x20) {\n");
+
+		if (bases & PCO_INT_HEX)
+			fprintf(gen->file, "\t\t\tcase 'x':\n\t\t\t\tshift = 4;\n\t\t\t\tbreak;\n\n");
+
+		if (bases & PCO_INT_OCT)
+			fprintf(gen->file, "\t\t\tcase 'o':\n\t\t\t\tshift = 3;\n\t\t\t\tbreak;\n\n");
+
+		if (bases & PCO_INT_BIN)
+			fprintf(gen->file, "\t\t\tcase 'b':\n\t\t\t\tshift = 1;\n\t\t\t\tbreak;\n\n");
+
+		fprintf(gen->file,
+			"\t\t\t}\n\n"
+			"\t\t\tif (shift != 0 && PCO_GEN_DIGIT(pos[2]) < 1u << shift)\n"
+			"\t\t\t\tpos += 2;\n"
+			"\t\t\telse\n"
+			"\t\t\t\tshift = 0;\n"
+			"\t\t}\n"
+			"\t}\n\n"
+			"\tdigits = pos;\n\n"
+			"\tif (shift != 0) {\n"
+			"\t\tfor (; pos != ctx->end && (digit = PCO_GEN_DIGIT(*pos)) < 1u << shift; pos++) {\n"
+			"\t\t\toverflow |= value >> (64 - shift) != 0;\n"
+			"\t\t\tvalue     = value << shift | digit;\n"
+			"\t\t}\n"
+			"\t} else {\n");
+	} else {
+		if (flags & PCO_INT_PREFIX)
+			fprintf(gen->file, "\tif (pos != ctx->end && *pos == '0' && ctx->end - pos < 3)\n\t\tctx->hit_end = true;\n\n");
+
+		fprintf(gen->file, "\tdigits = pos;\n\n\t{\n");
+	}
+
+	fprintf(gen->file,
+		"\t\tfor (; pos != ctx->end && (digit = (unsigned char) (*pos - '0')) < 10; pos++) {\n"
+		"\t\t\toverflow |= value > (UINT64_MAX - digit) / 10;\n"
+		"\t\t\tvalue     = value * 10 + digit;\n"
+		"\t\t}\n"
+		"\t}\n\n"
+		"\tif (pos == ctx->end)\n"
+		"\t\tctx->hit_end = true;\n\n"
+		"\tif (pos == digits) {\n"
+		"\t\tpco_gen_fail(ctx, pos, &set);\n\n"
+		"\t\treturn pco_gen_fail_result(ctx, pos);\n"
+		"\t}\n\n"
+		"\t/* magnitude of signed integer is up to 2^63 for negative and 2^63 - 1 for positive */\n"
+		"\tif (overflow%s) {\n"
+		"\t\tpco_gen_fail_overflow(ctx, str);\n\n"
+		"\t\treturn (struct pco_result) { .status = PCO_OVERFLOW, .rest = pos };\n"
+		"\t}\n\n",
+		sign ? " || value > (uint64_t) INT64_MAX + negative" : "");
+
+	if (sign) {
+		fprintf(gen->file, "\treturn (struct pco_result) { .status = PCO_OK, .rest = pos,\n"
+			"\t\t.data.integer = negative && value != 0 ? -(int64_t) (value - 1) - 1 : (int64_t) value };\n");
+	} else {
+		fprintf(gen->file, "\treturn (struct pco_result) { .status = PCO_OK, .rest = pos, .data.uinteger = value };\n");
+	}
+}
+
+/* print function appending decimal digits to mantissa, used by every pco_float node */
+static void gen_float_digits(struct gen* gen)
+{
+	fprintf(gen->file,
+		"/* append decimal digits from str to mantissa, fraction digits decrement scale, returns end of digits */\n"
+		"static const char* %s_float_digits(const char* str, const char* end, uint64_t* mantissa, unsigned* count,\n"
+		"\t\tint64_t* scale, bool* truncated, bool fraction)\n"
+		"{\n"
+		"\tfor (; str != end && (unsigned char) (*str - '0') < 10; str++) {\n"
+		"\t\tif (*count < %u) {\n"
+		"\t\t\tif (*mantissa != 0 || *str != '0')\n"
+		"\t\t\t\t(*count)++;\n\n"
+		"\t\t\t*mantissa = *mantissa * 10 + (uint64_t) (*str - '0');\n"
+		"\t\t\t*scale   -= fraction;\n"
+		"\t\t} else {\n"
+		"\t\t\t*truncated |= *str != '0';\n"
+		"\t\t\t*scale     += !fraction;\n"
+		"\t\t}\n"
+		"\t}\n\n"
+		"\treturn str;\n"
+		"}\n\n", gen->name, FLOAT_DIGITS);
+}
+
+/* print function for pco_float */
+static void gen_float(struct gen* gen)
+{
+	gen_digits(gen);
+	fprintf(gen->file,
+		"\tconst char* pos   = str;\n"
+		"\tconst char* digits;\n"
+		"\tuint64_t mantissa = 0;\n"
+		"\tunsigned count    = 0;\n"
+		"\tint64_t scale     = 0;\n"
+		"\tbool truncated    = false;\n"
+		"\tbool negative     = false;\n"
+		"\tbool exponent_negative;\n"
+		"\tint64_t exponent  = 0;\n"
+		"\tdouble value;\n\n"
+		"\tif (pos != ctx->end && *pos == '-') {\n"
+		"\t\tnegative = true;\n"
+		"\t\tpos++;\n"
+		"\t}\n\n"
+		"\t/* integer part is 0 or starts with nonzero digit */\n"
+		"\tdigits = pos;\n\n"
+		"\tif (pos != ctx->end && *pos == '0')\n"
+		"\t\tpos++;\n"
+		"\telse\n"
+		"\t\tpos = %s_float_digits(pos, ctx->end, &mantissa, &count, &scale, &truncated, false);\n\n"
+		"\tif (pos == digits) {\n"
+		"\t\tif (pos == ctx->end)\n"
+		"\t\t\tctx->hit_end = true;\n\n"
+		"\t\tpco_gen_fail(ctx, pos, &set);\n\n"
+		"\t\treturn pco_gen_fail_result(ctx, pos);\n"
+		"\t}\n\n"
+		"\t/* fraction and exponent are optional, their marker without digits is left as rest */\n"
+		"\tif (pos != ctx->end && *pos == '.') {\n"
+		"\t\tdigits = %s_float_digits(pos + 1, ctx->end, &mantissa, &count, &scale, &truncated, true);\n\n"
+		"\t\tif (digits == pos + 1)\n"
+		"\t\t\tpco_gen_fail(ctx, digits, &set);\n"
+		"\t\telse\n"
+		"\t\t\tpos = digits;\n\n"
+		"\t\tctx->hit_end |= digits == ctx->end;\n"
+		"\t}\n\n"
+		"\tif (pos != ctx->end && (*pos | 0x20) == 'e') {\n"
+		"\t\tconst char* marker;\n\n"
+		"\t\tdigits            = pos + 1;\n"
+		"\t\texponent_negative = digits != ctx->end && *digits == '-';\n\n"
+		"\t\tif (digits != ctx->end && (*digits == '+' || *digits == '-'))\n"
+		"\t\t\tdigits++;\n\n"
+		"\t\tfor (marker = digits; marker != ctx->end && (unsigned char) (*marker - '0') < 10; marker++)\n"
+		"\t\t\tif (exponent < %d)\n"
+		"\t\t\t\texponent = exponent * 10 + (*marker - '0');\n\n"
+		"\t\tctx->hit_end |= marker == ctx->end;\n\n"
+		"\t\tif (marker == digits) {\n"
+		"\t\t\tpco_gen_fail(ctx, digits, &set);\n"
+		"\t\t} else {\n"
+		"\t\t\tpos      = marker;\n"
+		"\t\t\texponent = exponent_negative ? -exponent : exponent;\n"
+		"\t\t}\n"
+		"\t}\n\n"
+		"\tif (pos == ctx->end)\n"
+		"\t\tctx->hit_end = true;\n\n"
+		"\texponent += scale;\n\n"
+		"\tif (mantissa == 0) {\n"
+		"\t\tvalue = 0;\n"
+		"#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0\n"
+		"\t/* both operands are exact, so single rounding of product or quotient is correct */\n"
+		"\t} else if (!truncated && mantissa <= (uint64_t) 1 << 53 && exponent >= -22 && exponent <= 22) {\n"
+		"\t\tstatic const double powers[] = {\n"
+		"\t\t\t1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,\n"
+		"\t\t\t1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,\n"
+		"\t\t};\n\n"
+		"\t\tvalue = exponent < 0 ? (double) mantissa / powers[-exponent] : (double) mantissa * powers[exponent];\n"
+		"#endif\n"
+		"\t} else {\n"
+		"\t\tvalue = pco_gen_float(ctx, str + negative, pos);\n"
+		"\t}\n\n"
+		"\tif (value > DBL_MAX)\n"
+		"\t\tpco_gen_fail_overflow(ctx, str);\n\n"
+		"\treturn (struct pco_result) { .status = value > DBL_MAX ? PCO_OVERFLOW : PCO_OK, .rest = pos,\n"
+		"\t\t.data.number = negative ? -value : value };\n",
+		gen->name, gen->name, FLOAT_EXPONENT);
+}
+
+/* print call of child parser */
+static void gen_call(struct gen* gen, struct pco_parser parser, const char* str)
+{
+	fprintf(gen->file, "%s_%u(ctx, ext, %s)", gen->name, gen_find(gen, parser), str);
+}
+
+/* print function for branch, alternatives are dispatched by switch on next character */
+static void gen_branch(struct gen* gen, struct branch_data* data)
+{
+	struct branch_table* table = &data->table;
+	struct first_set first;
+	unsigned longest = 0;
+	unsigned c, d, i;
+	const unsigned* list;
+
+	/* pco_ptr targets are known now, so table may be more precise */
+	if (!data->first.exact) {
+		table = size_alloc(&gen->ctx->grammar, struct branch_table);
+		branch_table_create(&gen->ctx->grammar, table, &first, data->parsers, data->count, FIRST_DEPTH);
+	}
+
+	for (c = 0; c <= 256; c++)
+		if (table->lists[table->lookup[c]] > longest)
+			longest = table->lists[table->lookup[c]];
+
+	gen_charset(gen, "set", table->expected.chars);
+
+	if (longest > 1)
+		fprintf(gen->file, "\tstruct pco_result result;\n\n");
+
+	fprintf(gen->file,
+		"\tif (str == ctx->end)\n"
+		"\t\tctx->hit_end = true;\n\n"
+		"\tswitch (str == ctx->end ? 256 : (unsigned char) *str) {\n");
+
+	for (c = 0; c <= 256; c++) {
+		list = table->lists + table->lookup[c];
+
+		/* every list is printed once, at its first character */
+		for (d = 0; d < c && table->lookup[d] != table->lookup[c]; d++);
+
+		if (d != c || list[0] == 0)
+			continue;
+
+		for (d = c; d <= 256; d++)
+			if (table->lookup[d] == table->lookup[c])
+				fprintf(gen->file, "\tcase %u:\n", d);
+
+		for (i = 1; i < list[0]; i++) {
+			fprintf(gen->file, "\t\tif ((result = ");
+			gen_call(gen, data->parsers[list[i]], "str");
+			fprintf(gen->file, ").status == PCO_OK)\n\t\t\treturn result;\n\n");
+		}
+
+		fprintf(gen->file, "\t\treturn ");
+		gen_call(gen, data->parsers[list[list[0]]], "str");
+		fprintf(gen->file, ";\n\n");
+	}
+
+	/* no alternative can start with this character */
+	fprintf(gen->file, "\t}\n\n"
+		"\tpco_gen_fail(ctx, str, &set);\n\n"
+		"\treturn pco_gen_fail_result(ctx, str);\n");
+}
+
+/* print function for node */
+static void gen_node(struct gen* gen, unsigned index)
+{
+	struct pco_parser parser = gen->nodes[index].parser;
+	unsigned ext             = gen->nodes[index].ext;
+	struct pco_charset set;
+	char cond[32];
+	struct sequence_data* sequence;
+	struct repeat_data* repeat;
+	struct str_data* str;
+	size_t i;
+
+	fprintf(gen->file, "static struct pco_result %s_%u(struct pco_ctx* ctx, const union pco_extern* ext, const char* str)\n{\n",
+			gen->name, index);
+
+	if (parser.parser == (pco_parser_f) char_parser) {
+		pco_create_charset(&set);
+		pco_charset_add(&set, *(char*) parser.data);
+		gen_charset(gen, "set", set.chars);
+
+		fprintf(gen->file, "\tchar* c;\n\n");
+		snprintf(cond, sizeof(cond), "*str != (char) %d", *(char*) parser.data);
+		gen_leaf_fail(gen, cond);
+		fprintf(gen->file,
+			"\tif (ctx->discard)\n"
+			"\t\treturn (struct pco_result) { .status = PCO_OK, .rest = str + 1 };\n\n"
+			"\tif ((c = pco_gen_alloc(ctx, 1)) != NULL)\n"
+			"\t\t*c = *str;\n\n"
+			"\treturn (struct pco_result) { .status = PCO_OK, .rest = str + 1, .data.result = c };\n");
+	} else if (parser.parser == (pco_parser_f) str_parser) {
+		str = parser.data;
+
+		fprintf(gen->file, "\tstatic const char lit[] = ");
+		gen_string(gen, str->str, str->len);
+		fprintf(gen->file, ";\n\n"
+			"\tif ((size_t) (ctx->end - str) < %zu) {\n"
+			"\t\tctx->hit_end = true;\n"
+			"\t\tpco_gen_fail_str(ctx, lit, %zu, str);\n\n"
+			"\t\treturn (struct pco_result) { .status = PCO_END_OF_INPUT, .rest = str };\n"
+			"\t}\n\n"
+			"\tif (memcmp(str, lit, %zu)) {\n"
+			"\t\tpco_gen_fail_str(ctx, lit, %zu, str);\n\n"
+			"\t\treturn (struct pco_result) { .status = PCO_UNEXEPTED, .rest = str, .data.unexepted = *str };\n"
+			"\t}\n\n"
+			"\treturn (struct pco_result) { .status = PCO_OK, .rest = str + %zu, .data.result = (char*) lit };\n",
+			str->len, str->len, str->len, str->len, str->len);
+	} else if (parser.parser == (pco_parser_f) charset_parser) {
+		gen_charset(gen, "set", ((struct pco_charset*) parser.data)->chars);
+		gen_leaf_fail(gen, "!PCO_GEN_HAS(&set, *str)");
+		fprintf(gen->file, "\treturn (struct pco_result) { .status = PCO_OK, .rest = str + 1, .data.result = (char*) str };\n");
+	} else if (parser.parser == (pco_parser_f) span_parser) {
+		gen_charset(gen, "set", ((struct span_data*) parser.data)->set.chars);
+		fprintf(gen->file,
+			"\tconst char* c;\n\n"
+			"\tfor (c = str; c != ctx->end && PCO_GEN_HAS(&set, *c); c++);\n\n"
+			"\treturn pco_gen_span(ctx, str, c);\n");
+	} else if (parser.parser == (pco_parser_f) keywords_parser) {
+		gen_keywords(gen, parser.data);
+	} else if (parser.parser == (pco_parser_f) int64_parser || parser.parser == (pco_parser_f) uint64_parser) {
+		gen_int(gen, ((struct int_data*) parser.data)->flags, parser.parser == (pco_parser_f) int64_parser);
+	} else if (parser.parser == (pco_parser_f) float_parser) {
+		gen_float(gen);
+	} else if (parser.parser == (pco_parser_f) filter_parser) {
+		fprintf(gen->file,
+			"\tconst char* c;\n\n"
+			"\tfor (c = str; c != ctx->end && ext[%u].filter(*c); c++);\n\n"
+			"\treturn pco_gen_span(ctx, str, c);\n", ext);
+	} else if (parser.parser == (pco_parser_f) repeat_parser || parser.parser == (pco_parser_f) not_empty_repeat_parser) {
+		repeat = parser.data;
+
+		fprintf(gen->file,
+			"\tstruct pco_result_array* arr = pco_gen_array(ctx, %u);\n"
+			"\tstruct pco_result result;\n"
+			"\tconst char* rest = str;\n\n"
+			"\twhile ((result = ", repeat->hint);
+		gen_call(gen, repeat->parser, "rest");
+		fprintf(gen->file, ").status == PCO_OK) {\n"
+			"\t\trest = result.rest;\n"
+			"\t\tpco_gen_add(ctx, arr, result.data.result);\n"
+			"\t}\n\n");
+
+		if (parser.parser == (pco_parser_f) not_empty_repeat_parser)
+			fprintf(gen->file, "\tif (rest == str)\n\t\treturn pco_gen_fail_result(ctx, str);\n\n");
+
+		fprintf(gen->file, "\treturn (struct pco_result) { .status = PCO_OK, .rest = rest, .data.result = arr };\n");
+	} else if (parser.parser == (pco_parser_f) fold_parser) {
+		fprintf(gen->file,
+			"\tstruct pco_mark mark = pco_gen_mark(ctx);\n"
+			"\tstruct pco_result result;\n"
+			"\tconst char* rest = str;\n"
+			"\tvoid* acc = ext[%u].fold.init;\n\n"
+			"\twhile ((result = ", ext);
+		gen_call(gen, ((struct fold_data*) parser.data)->parser, "rest");
+		fprintf(gen->file, ").status == PCO_OK) {\n"
+			"\t\trest = result.rest;\n"
+			"\t\tacc  = pco_gen_fold(ctx, ext[%u].fold.step, acc, result.data.result, mark);\n"
+			"\t}\n\n"
+			"\tpco_gen_rewind(ctx, mark);\n\n"
+			"\treturn (struct pco_result) { .status = PCO_OK, .rest = rest, .data.result = acc };\n", ext);
+	} else if (parser.parser == (pco_parser_f) branch_parser) {
+		gen_branch(gen, parser.data);
+	} else if (parser.parser == (pco_parser_f) sequence_parser) {
+		sequence = parser.data;
+
+		fprintf(gen->file,
+			"\tstruct pco_result_array* arr = pco_gen_array(ctx, %u);\n"
+			"\tstruct pco_result result;\n"
+			"\tconst char* rest = str;\n\n", sequence->count);
+
+		for (i = 0; i < sequence->count; i++) {
+			fprintf(gen->file, "\tif ((result = ");
+			gen_call(gen, sequence->parsers[i], "rest");
+			fprintf(gen->file, ").status != PCO_OK)\n\t\treturn result;\n\n"
+				"\trest = result.rest;\n"
+				"\tpco_gen_add(ctx, arr, result.data.result);\n\n");
+		}
+
+		fprintf(gen->file, "\treturn (struct pco_result) { .status = PCO_OK, .rest = rest, .data.result = arr };\n");
+	} else if (parser.parser == (pco_parser_f) map_parser) {
+		fprintf(gen->file, "\tstruct pco_result result = ");
+		gen_call(gen, ((struct map_data*) parser.data)->parser, "str");
+		fprintf(gen->file, ";\n\n\tif (result.status == PCO_OK && !ctx->discard && !ctx->no_memory) {\n");
+
+		for (i = 0; i < ((struct map_data*) parser.data)->count; i++)
+			fprintf(gen->file, "\t\text[%u].map(ctx, &result);\n", (unsigned) (ext + i));
+
+		fprintf(gen->file, "\t}\n\n\treturn result;\n");
+	} else if (parser.parser == (pco_parser_f) check_parser) {
+		fprintf(gen->file, "\tstruct pco_result result = ");
+		gen_call(gen, ((struct check_data*) parser.data)->parser, "str");
+		fprintf(gen->file, ";\n\n"
+			"\tif (result.status == PCO_OK && !ext[%u].check(ctx, str, (size_t) (result.rest - str)))\n"
+			"\t\treturn pco_gen_fail_result(ctx, str);\n\n"
+			"\treturn result;\n", ext);
+	} else if (parser.parser == (pco_parser_f) slice_parser) {
+		fprintf(gen->file, "\tstruct pco_result result;\n\n\tctx->discard++;\n\tresult = ");
+		gen_call(gen, *(struct pco_parser*) parser.data, "str");
+		fprintf(gen->file, ";\n\tctx->discard--;\n\n"
+			"\tif (result.status == PCO_OK)\n"
+			"\t\tresult.data.result = pco_gen_slice(ctx, str, result.rest);\n\n"
+			"\treturn result;\n");
+	} else if (parser.parser == (pco_parser_f) skip_parser) {
+		fprintf(gen->file, "\tstruct pco_result result;\n\n\tctx->discard++;\n\tresult = ");
+		gen_call(gen, *(struct pco_parser*) parser.data, "str");
+		fprintf(gen->file, ";\n\tctx->discard--;\n\n"
+			"\tif (result.status == PCO_OK)\n"
+			"\t\tresult.data.result = NULL;\n\n"
+			"\treturn result;\n");
+	} else if (parser.parser == (pco_parser_f) memo_parser) {
+		fprintf(gen->file,
+			"\tstatic const char key;\n"
+			"\tconst struct pco_result* cached = pco_gen_memo_find(ctx, &key, str);\n"
+			"\tstruct pco_result result;\n\n"
+			"\tif (cached != NULL)\n"
+			"\t\treturn *cached;\n\n"
+			"\tresult = ");
+		gen_call(gen, *(struct pco_parser*) parser.data, "str");
+		fprintf(gen->file, ";\n\tpco_gen_memo_insert(ctx, &key, str, result);\n\n\treturn result;\n");
+	} else {
+		fprintf(gen->file, "\treturn ext[%u].parser.parser(ctx, ext[%u].parser.data, str);\n", ext, ext);
+	}
+
+	fprintf(gen->file, "}\n\n");
+}
+
+/* write c code of parser specialized for grammar to file */
+bool pco_generate(struct pco_ctx* ctx, struct pco_parser parser, const char* name, FILE* file)
+{
+	struct gen gen = {
+		.ctx  = ctx,
+		.file = file,
+		.name = name,
+	};
+	bool floats = false;
+	unsigned i;
+
+	gen_walk(&gen, parser);
+	gen_keys(&gen);
+
+	/* externs table is printed in order of indexes used by code */
+	if (gen.externs_count != 0)
+		qsort(gen.externs, gen.externs_count, sizeof(struct gen_extern), gen_index_compare);
+
+	fprintf(file, "/* %s - parser generated by pco_generate, do not edit */\n\n"
+		"#include <stdbool.h>\n"
+		"#include <stdint.h>\n"
+		"#include <string.h>\n"
+		"#include <float.h>\n\n"
+		"#if defined(_pco_h) && !defined(PCO_GENERATED_RUNTIME) && !defined(PCO_IMPLEMENTATION)\n"
+		"#error \"define PCO_GENERATED_RUNTIME before first include of pco.h\"\n"
+		"#endif\n\n"
+		"#define PCO_GENERATED_RUNTIME\n"
+		"#include \"pco.h\"\n\n"
+		"#ifndef PCO_GEN_HAS\n"
+		"#define PCO_GEN_HAS(set, c) ((set)->chars[(unsigned char) (c) / 8] >> (unsigned char) (c) %% 8 & 1)\n"
+		"#endif\n\n"
+		"#ifndef PCO_GEN_DIGIT\n"
+		"#define PCO_GEN_DIGIT(c) ((c) >= '0' && (c) <= '9' ? (unsigned) ((c) - '0') \\\n"
+		"\t: ((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'f' ? (unsigned) (((c) | 0x20) - 'a' + 10) : 16u)\n"
+		"#endif\n\n"
+		"/* keys of maps, folds, filters and opaque parsers called by generated code, use with pco_generated */\n"
+		"const char* const %s_externs[] = {\n", name, name);
+
+	for (i = 0; i < gen.externs_count; i++) {
+		fprintf(file, "\t");
+		gen_string(&gen, gen.externs[i].key, strlen(gen.externs[i].key));
+		fprintf(file, ",\n");
+	}
+
+	fprintf(file, "\tNULL,\n};\n\n");
+
+	for (i = 0; i < gen.count; i++) {
+		fprintf(file, "static struct pco_result %s_%u(struct pco_ctx* ctx, const union pco_extern* ext, const char* str);\n",
+				name, i);
+
+		floats |= gen.nodes[i].parser.parser == (pco_parser_f) float_parser;
+	}
+
+	fprintf(file, "\n");
+
+	if (floats)
+		gen_float_digits(&gen);
+
+	for (i = 0; i < gen.count; i++)
+		gen_node(&gen, i);
+
+	fprintf(file, "/* parser function, use with pco_generated */\n"
+		"struct pco_result %s(struct pco_ctx* ctx, void* data, const char* str)\n"
+		"{\n"
+		"\treturn %s_0(ctx, data, str);\n"
+		"}\n", name, name);
+
+	PCO_FREE(gen.nodes);
+	PCO_FREE(gen.slots);
+	PCO_FREE(gen.externs);
+
+	return !ferror(file);
+}
+
+/* make parser from function generated by pco_generate and its externs table, returns
+ * parser with NULL function if grammar does not match generated code */
+struct pco_parser pco_generated(struct pco_ctx* ctx, struct pco_parser parser, pco_parser_f generated,
+		const char* const* externs)
+{
+	struct gen gen = {
+		.ctx = ctx,
+	};
+	struct pco_parser result = {
+		.parser = NULL,
+		.data   = NULL,
+	};
+	struct gen_extern* found;
+	union pco_extern* ext;
+	unsigned i;
+
+	gen_walk(&gen, parser);
+	gen_keys(&gen);
+
+	ext = grammar_alloc(&ctx->grammar, (gen.externs_count + 1) * sizeof(union pco_extern));
+
+	/* every extern of grammar must be in table once, so changed grammar is not bound to old code */
+	for (i = 0; externs[i] != NULL; i++) {
+		found = gen.externs_count == 0 ? NULL
+			: bsearch(externs[i], gen.externs, gen.externs_count, sizeof(struct gen_extern), gen_key_find);
+
+		if (found == NULL || found->bound)
+			goto stop;
+
+		found->bound = true;
+		ext[i]       = found->value;
+	}
+
+	if (i == gen.externs_count) {
+		result.parser = generated;
+		result.data   = ext;
+	}
+
+stop:
+	PCO_FREE(gen.nodes);
+	PCO_FREE(gen.slots);
+	PCO_FREE(gen.externs);
 
-fail:
 	return result;
 }
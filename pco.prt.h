@@ -9,53 +9,181 @@
  * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
  * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE. */
 
-/* pco.h - parser combinators library for c */
+/* pco.h - parser combinators library for c
+ *
+ * needs C11 (max_align_t, _Alignof) and POSIX 2008 (newlocale, uselocale, pthread),
+ * so build with -std=c11 or gnu11 and -D_POSIX_C_SOURCE=200809L when -pedantic is
+ * used, cpu count and page size are asked with getauxval and get_nprocs on linux,
+ * parse functions return PCO_NO_MEMORY when memory for results ends, constructors
+ * abort process when memory for parsers data ends */
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PCO_BRANCH_PARSERS_COUNT 128	/* max parsers in struct pco_branch, pco_branch_n has no limit */
+#define PCO_CHUNK_SIZE 65536		/* min size of arena chunk */
+#define PCO_MEMO_LIMIT 65536		/* default max results cached by pco_memo */
+#define PCO_STREAM_CHUNK 65536		/* default size of one read from stream */
+
+/* set of characters */
+struct pco_charset {
+	unsigned char chars[32];	/* bitmap, bit for every character */
+};
+
+/* bump allocator, frees all memory at once */
+struct pco_arena {
+	struct pco_chunk* head;	/* first chunk */
+	struct pco_chunk* cur;	/* chunk for next allocation */
+};
+
+/* position in arena, allocations made after it can be freed at once */
+struct pco_mark {
+	struct pco_chunk* chunk;	/* chunk of next allocation */
+	size_t used;			/* used size of chunk */
+	size_t keys;			/* memo keys logged before mark by pco_fold */
+};
+
+/* cache for pco_memo parsers */
+struct pco_memo {
+	struct pco_memo_entry* entries;	/* hash table */
+	size_t size;			/* table size, power of 2 */
+	size_t count;			/* used entries */
+	size_t limit;			/* max table size, may be changed after pco_create_ctx */
+	unsigned gen;			/* current generation, bumped to clear table */
+
+	struct pco_memo_key* log;	/* keys inserted while pco_fold runs */
+	size_t log_count;		/* logged keys */
+	size_t log_size;		/* allocated keys */
+	unsigned folds;			/* running pco_fold parsers, keys are logged if not zero */
+};
 
-#define PCO_BRANCH_PARSERS_COUNT 128	/* max parsers in branch */
+/* profile counters of parsers run with context, present without PCO_PROFILE too, so
+ * code built with and without it can share contexts */
+struct pco_profile {
+	struct pco_profile_entry* entries;	/* hash table */
+	size_t size;				/* table size, power of 2 */
+	size_t count;				/* used entries */
+};
 
-/* parsers context */
+/* parsers context, also used as parse session: parsers built in one context
+ * can be run with any other context, which then holds only parse results */
 struct pco_ctx {
-	void** parsers_data;
-	unsigned size;
+	struct pco_arena grammar;	/* parsers data, lives until pco_free_ctx */
+	struct pco_arena results;	/* parse results, lives until pco_reset_ctx */
+	struct pco_arena folds;		/* memory allocated by pco_fold steps, lives until pco_reset_ctx */
+
+	const char* end;		/* end of input being parsed */
+	bool hit_end;			/* set when some parser looked at end of input */
+	unsigned discard;		/* parsers do not build results if not zero */
+
+	struct pco_memo memo;		/* cached results of pco_memo parsers */
+
+	const char* fail;		/* furthest input position where some parser failed */
+	struct pco_charset expected;	/* characters excepted at fail */
+	bool expected_end;		/* end of input excepted at fail */
+	bool overflow;			/* number at fail does not fit in its type */
+	bool no_memory;			/* memory for results ended, parse fails with PCO_NO_MEMORY */
+
+	const char* file;		/* input mapped by pco_run_parser_file, unmapped by pco_reset_ctx */
+	size_t file_size;		/* size of mapped input */
+
+	struct pco_profile profile;	/* counters of parsers, empty without PCO_PROFILE */
+};
+
+/* parsers moved out of context by pco_freeze, read-only */
+struct pco_grammar {
+	struct pco_arena arena;	/* parsers data */
 };
 
 /* exit status */
 enum pco_status {
 	PCO_OK = 0,		/* no errors */
-	PCO_END_OF_INPUT,	/* excepted character but string ends */
+	PCO_END_OF_INPUT,	/* excepted character but input ends */
 	PCO_UNEXEPTED,		/* unexepted character */
+	PCO_IO_ERROR,		/* stream read function failed, see errno */
+	PCO_OVERFLOW,		/* number does not fit in its type */
+	PCO_NO_MEMORY,		/* memory for results can not be allocated */
 };
 
 
+/* part of input, points to input without copying it */
+struct pco_slice {
+	const char* ptr;	/* first character */
+	size_t len;		/* characters count */
+};
+
 /* parser result type */
 struct pco_result {
 	enum pco_status status;	/* status code */
 	const char* rest;	/* unprocessed string */
 
 	union {
-		void* result;	/* parser result, real type depends on parser */
-		char unexepted;	/* unexepted character */
+		void* result;		/* parser result, real type depends on parser */
+		char unexepted;		/* unexepted character */
+		int64_t integer;	/* result of pco_int64, stored in place of pointer in arrays */
+		uint64_t uinteger;	/* result of pco_uint64, stored in place of pointer in arrays */
+		double number;		/* result of pco_float, stored in place of pointer in arrays */
 	} data;
 };
 
 /* parser function type */
 typedef struct pco_result (*pco_parser_f)(struct pco_ctx* ctx, void* data, const char* str);
 
-/* parser */
+/* parser, pair of function and data identifies parser node for profiler, pco_name,
+ * pco_memo and pco_generate, so every constructor allocates its own data and custom
+ * parsers must not share data between nodes */
 struct pco_parser {
 	pco_parser_f parser;	/* parser function */
 	void* data;		/* arguments for parser function */
 };
 
+/* read function for stream, returns bytes read, 0 at end of input or -1 on error */
+typedef long (*pco_read_f)(void* data, char* buf, size_t size);
+
+struct pco_stream;
+
+/* called for every item parsed from stream, result and input it points to are
+ * valid only until return, returns false to stop parsing */
+typedef bool (*pco_item_f)(struct pco_ctx* ctx, struct pco_stream* stream, struct pco_result* result);
+
+/* input for pco_run_parser_stream */
+struct pco_stream {
+	pco_read_f read;	/* read function */
+	void* data;		/* argument for read function */
+
+	pco_item_f item;	/* item function, may be NULL */
+	void* item_data;	/* user data for item function */
+
+	size_t chunk;		/* bytes requested by one read, PCO_STREAM_CHUNK if zero */
+	size_t committed;	/* bytes of input parsed by items, they are never read again */
+	size_t peak;		/* max size of input window in bytes */
+	size_t fail;		/* offset of furthest failure on error */
+};
+
+/* counters of one parser node */
+struct pco_profile_entry {
+	pco_parser_f parser;		/* parser function, NULL for empty entry */
+	void* data;			/* parser data */
+	const char* name;		/* name given by pco_name or NULL */
+
+	unsigned long long calls;	/* invocations */
+	unsigned long long ok;		/* successes */
+	unsigned long long fail;	/* failures, backtracks of callers */
+	unsigned long long bytes;	/* input consumed by successes */
+	unsigned long long time;	/* nanoseconds spent in parser, nested calls included */
+	unsigned active;		/* running invocations */
+};
+
 /* array type for parser result */
 struct pco_result_array {
-	void** results;	/* elements */
-	unsigned size;	/* element count */
+	void** results;		/* elements */
+	unsigned size;		/* element count */
+	unsigned capacity;	/* allocated elements */
 };
 
-/* array for parsers */
+/* array for parsers, only count parsers are copied to grammar */
 struct pco_branch {
 	struct pco_parser parsers[PCO_BRANCH_PARSERS_COUNT];
 	unsigned count;
@@ -67,6 +195,17 @@ void pco_create_ctx(struct pco_ctx* ctx);
 /* free context */
 void pco_free_ctx(struct pco_ctx* ctx);		
 
+/* free all parse results in context, parsers stay valid */
+void pco_reset_ctx(struct pco_ctx* ctx);
+
+/* move all parsers built in ctx to grammar and make their memory read-only, parsers
+ * stay valid until pco_free_grammar and may be run from many threads at once, each
+ * thread with its own context, returns NULL if out of memory */
+struct pco_grammar* pco_freeze(struct pco_ctx* ctx);
+
+/* free grammar, parsers from it become invalid */
+void pco_free_grammar(struct pco_grammar* grammar);
+
 /* parse one character, sets result to char* from one character */
 struct pco_parser pco_char(struct pco_ctx* ctx, char c);
 
@@ -79,41 +218,251 @@ struct pco_parser pco_tab(struct pco_ctx* ctx);
 /* parse space character */
 struct pco_parser pco_space(struct pco_ctx* ctx);
 
-/* parse \t, \n or space character */
+/* parse \t, \n or space character, sets result to char* pointing to character in input */
 struct pco_parser pco_anyspace(struct pco_ctx* ctx);
 
 /* parse \t or space character many times or parse nothing */
 struct pco_parser pco_manyspace(struct pco_ctx* ctx);
 
-/* parse integer */
+/* skip \t, \n and space characters or nothing, sets result to NULL */
+struct pco_parser pco_skipspace(struct pco_ctx* ctx);
+
+/* parse decimal integer, sets result to int*, values above INT_MAX are clamped to
+ * INT_MAX, pco_int64 fails on overflow instead */
 struct pco_parser pco_integer(struct pco_ctx* ctx);
 
+/* flags of pco_int64 and pco_uint64 */
+enum pco_int_flags {
+	PCO_INT_SIGN   = 1 << 0,	/* allow + or - sign, only + for pco_uint64 */
+	PCO_INT_HEX    = 1 << 1,	/* allow 0x prefix */
+	PCO_INT_OCT    = 1 << 2,	/* allow 0o prefix */
+	PCO_INT_BIN    = 1 << 3,	/* allow 0b prefix */
+	PCO_INT_PREFIX = PCO_INT_HEX | PCO_INT_OCT | PCO_INT_BIN,
+};
+
+/* parse decimal integer, flags allow sign and 0x, 0o and 0b prefixes, sets result
+ * data.integer, fails with PCO_OVERFLOW if integer does not fit in int64_t */
+struct pco_parser pco_int64(struct pco_ctx* ctx, unsigned flags);
+
+/* parse decimal integer, flags allow + sign and 0x, 0o and 0b prefixes, sets result
+ * data.uinteger, fails with PCO_OVERFLOW if integer does not fit in uint64_t */
+struct pco_parser pco_uint64(struct pco_ctx* ctx, unsigned flags);
+
+/* parse json number, sets result data.number, fails with PCO_OVERFLOW if number
+ * is too big for double */
+struct pco_parser pco_float(struct pco_ctx* ctx);
+
 /* parse string, sets result to char* from excepted string */
 struct pco_parser pco_str(struct pco_ctx* ctx, const char* str);
 
+/* parse longest of count words in one pass over input, words are stored in trie,
+ * sets result to char* from copy of matched word */
+struct pco_parser pco_keywords(struct pco_ctx* ctx, const char* const* words, unsigned count);
+
 typedef bool (*pco_filter_f)(char);					/* filter function */
 typedef void (*pco_map_f)(struct pco_ctx*, struct pco_result* result);	/* map function */
+typedef void* (*pco_fold_f)(struct pco_ctx*, void* acc, void* item);	/* fold function, returns new accumulator */
+typedef bool (*pco_check_f)(struct pco_ctx*, const char* str, size_t len);	/* check function */
 
 /* parse characters while filter return true, sets result to char* from parsed characters */
 struct pco_parser pco_filter(struct pco_ctx* ctx, pco_filter_f filter);
 
-/* process other parser result */
+/* create empty character set */
+void pco_create_charset(struct pco_charset* set);
+
+/* add character to set */
+void pco_charset_add(struct pco_charset* set, char c);
+
+/* add characters from first to last to set */
+void pco_charset_add_range(struct pco_charset* set, char first, char last);
+
+/* add characters for which filter return true to set */
+void pco_charset_add_filter(struct pco_charset* set, pco_filter_f filter);
+
+/* check if character in set */
+bool pco_charset_has(const struct pco_charset* set, char c);
+
+/* parse one character from set, sets result to char* pointing to character in input */
+struct pco_parser pco_charset(struct pco_ctx* ctx, const struct pco_charset* set);
+
+/* parse one character from first to last, sets result to char* pointing to character in input */
+struct pco_parser pco_range(struct pco_ctx* ctx, char first, char last);
+
+/* parse characters while they are in set, sets result to char* from parsed characters,
+ * sets from few ranges like digits or letters are scanned with simd when cpu supports it */
+struct pco_parser pco_charset_filter(struct pco_ctx* ctx, const struct pco_charset* set);
+
+/* process other parser result, map is not called inside pco_slice, pco_skip and
+ * skip combinators because results are not built there, so map which fails
+ * result to reject input does not reject it there, use pco_check for that */
 struct pco_parser pco_map(struct pco_ctx* ctx, struct pco_parser parser, pco_map_f map);
 
+/* apply parser and fail at its start if check returns false for len matched bytes
+ * at str, check is called inside pco_slice, pco_skip and skip combinators too,
+ * so it rejects input there, unlike map */
+struct pco_parser pco_check(struct pco_ctx* ctx, struct pco_parser parser, pco_check_f check);
+
 /* apply parser many times while it not throw error */
 struct pco_parser pco_repeat(struct pco_ctx* ctx, struct pco_parser parser);
 
+/* apply parser many times while it not throw error, results array is
+ * allocated for hint results at once */
+struct pco_parser pco_repeat_hint(struct pco_ctx* ctx, struct pco_parser parser, unsigned hint);
+
 /* apply parser many times while it not throw error but output should be not empty */
 struct pco_parser pco_not_empty_repeat(struct pco_ctx* ctx, struct pco_parser parser);
 
-/* apply parsers from branch while parser not throw error */
+/* apply parser many times while it not throw error, every result is passed to
+ * step with accumulator and freed after it, so parse results take constant
+ * memory, memory allocated by step in ctx is kept until pco_reset_ctx, sets
+ * result to accumulator returned by last step or init */
+struct pco_parser pco_fold(struct pco_ctx* ctx, struct pco_parser parser, void* init, pco_fold_f step);
+
+/* apply parsers from branch while parser not throw error, only parsers which
+ * can start with next input character are tried */
 struct pco_parser pco_branch(struct pco_ctx* ctx, struct pco_branch branch);
 
+/* apply count parsers from array while parser not throw error, only parsers which
+ * can start with next input character are tried */
+struct pco_parser pco_branch_n(struct pco_ctx* ctx, const struct pco_parser* parsers, unsigned count);
+
 /* apply all parsers from sequence */
 struct pco_parser pco_sequence(struct pco_ctx* ctx, struct pco_branch sequence);
 
+/* apply count parsers from array one after another */
+struct pco_parser pco_sequence_n(struct pco_ctx* ctx, const struct pco_parser* parsers, unsigned count);
+
+/* apply parser without building its results and without calling maps in it, so
+ * status set by maps is ignored but pco_check is applied, sets result to struct
+ * pco_slice* of parsed input */
+struct pco_parser pco_slice(struct pco_ctx* ctx, struct pco_parser parser);
+
+/* apply parser without building its results and without calling maps in it, so
+ * status set by maps is ignored but pco_check is applied, sets result to NULL */
+struct pco_parser pco_skip(struct pco_ctx* ctx, struct pco_parser parser);
+
+/* apply parser many times while it not throw error without building results, sets result to NULL */
+struct pco_parser pco_skip_repeat(struct pco_ctx* ctx, struct pco_parser parser);
+
+/* apply all parsers from sequence without building results, sets result to NULL */
+struct pco_parser pco_skip_sequence(struct pco_ctx* ctx, struct pco_branch sequence);
+
+/* apply count parsers from array one after another without building results, sets result to NULL */
+struct pco_parser pco_skip_sequence_n(struct pco_ctx* ctx, const struct pco_parser* parsers, unsigned count);
+
 /* apply parser from parser (useful in recursive parsers) */
 struct pco_parser pco_ptr(struct pco_ctx* ctx, struct pco_parser* parser);
 
+/* cache parser results by input position, makes backtracking into parser at
+ * same position free, side effects of maps in parser happen only once */
+struct pco_parser pco_memo(struct pco_ctx* ctx, struct pco_parser parser);
+
+/* compile parser to bytecode, returned parser gives same results, it runs without
+ * recursion and is faster on deeply nested grammars but about as fast as parser on
+ * flat ones, parsers referenced by pco_ptr must be already defined */
+struct pco_parser pco_compile(struct pco_ctx* ctx, struct pco_parser parser);
+
+/* rewrite grammar to grammar with same results which needs fewer parser calls,
+ * pco_ptr targets must be defined before it, which is asserted, and must not be
+ * changed after it, gain depends on grammar and may be none, so measure it */
+struct pco_parser pco_optimize(struct pco_ctx* ctx, struct pco_parser parser);
+
 /* run parser on str */
 struct pco_result pco_run_parser(struct pco_ctx* ctx, const struct pco_parser* parser, const char* str);
+
+/* run parser on len bytes from buf, buf may be not null-terminated,
+ * on error result and ctx->fail point to furthest position where some parser failed
+ * and ctx->expected holds characters which parsers excepted there, PCO_NO_MEMORY
+ * status is returned with rest at buf if memory for results ended */
+struct pco_result pco_run_parser_n(struct pco_ctx* ctx, const struct pco_parser* parser, const char* buf, size_t len);
+
+/* get line and column of pos in input starting at begin, both counted from 1 */
+void pco_position(const char* begin, const char* pos, size_t* line, size_t* column);
+
+/* run parser on file without copying it: file is mapped to memory and results may point
+ * into it until pco_reset_ctx, pco_free_ctx or next pco_run_parser_file with ctx,
+ * returns PCO_IO_ERROR status if file can not be mapped, see errno */
+struct pco_result pco_run_parser_file(struct pco_ctx* ctx, const struct pco_parser* parser, const char* path);
+
+/* run parser on input from stream item by item: parser is applied repeatedly and every
+ * result is passed to item function, input is read by chunks and only input of current
+ * item is kept, item is parsed again with more input if some parser looked at end of
+ * window, custom parser functions must set ctx->hit_end when they do so,
+ * item is parsed again only when its input at least doubled, results of every item
+ * are freed after item function returns without touching results made before the call,
+ * rest of returned result is NULL and its data is NULL unless status is PCO_UNEXEPTED,
+ * on error stream->committed is offset of item that failed */
+struct pco_result pco_run_parser_stream(struct pco_ctx* ctx, const struct pco_parser* parser, struct pco_stream* stream);
+
+/* run parser on input from file descriptor item by item, see pco_run_parser_stream,
+ * data is passed to item function in stream->item_data */
+struct pco_result pco_run_parser_fd(struct pco_ctx* ctx, const struct pco_parser* parser, int fd, pco_item_f item, void* data);
+
+/* run parser on records from len bytes at buf in threads threads (number of cpus if zero):
+ * input is split after delim characters into parts which are parsed at once, parser is
+ * applied to every part repeatedly like pco_repeat and must consume it whole, so records
+ * must end with delim and contain it only at end, sets result to array of item results
+ * in input order, parser and its maps must be safe to run in many threads,
+ * needs linking with -pthread */
+struct pco_result pco_run_parser_parallel(struct pco_ctx* ctx, const struct pco_parser* parser, const char* buf, size_t len,
+		char delim, unsigned threads);
+
+/* give parser name shown by pco_profile_dump, returns parser itself if library is
+ * built without PCO_PROFILE */
+struct pco_parser pco_name(struct pco_ctx* ctx, struct pco_parser parser, const char* name);
+
+/* print counters of every parser node run with ctx as tab-separated table sorted by
+ * time, counters are collected only if library is built with PCO_PROFILE defined,
+ * parser made by pco_compile is counted as one node */
+void pco_profile_dump(struct pco_ctx* ctx, FILE* file);
+
+/* reset profile counters in ctx */
+void pco_profile_reset(struct pco_ctx* ctx);
+
+/* write c code of parser specialized for grammar to file: every node becomes static
+ * function with characters, strings, keyword tries, number parsers and branch
+ * dispatch tables as code and direct calls to children, generated function is
+ * called name and has pco_parser_f type, maps, folds, filters and unknown parsers
+ * are called through externs table bound by pco_generated from keys written to
+ * array name_externs, returns false on write error */
+bool pco_generate(struct pco_ctx* ctx, struct pco_parser parser, const char* name, FILE* file);
+
+/* make parser from function generated by pco_generate for same grammar and its
+ * externs keys, every extern of grammar is bound by its key, so returns parser with
+ * NULL function if grammar is changed after code was generated */
+struct pco_parser pco_generated(struct pco_ctx* ctx, struct pco_parser parser, pco_parser_f generated,
+		const char* const* externs);
+
+/* runtime of code written by pco_generate, it is not part of api and may change with
+ * library, generated code defines PCO_GENERATED_RUNTIME before including pco.h */
+#if defined(PCO_GENERATED_RUNTIME) || defined(PCO_IMPLEMENTATION)
+/* table of maps, checks, filters and opaque parsers used by generated parser */
+union pco_extern {
+	pco_map_f map;			/* map function of pco_map */
+	pco_filter_f filter;		/* filter function of pco_filter */
+	pco_check_f check;		/* check function of pco_check */
+	struct pco_parser parser;	/* parser not known to generator, like compiled one */
+
+	struct {
+		void* init;		/* initial accumulator of pco_fold */
+		pco_fold_f step;	/* fold function of pco_fold */
+	} fold;
+};
+
+/* functions used by code from pco_generate */
+void* pco_gen_alloc(struct pco_ctx* ctx, size_t size);
+struct pco_result_array* pco_gen_array(struct pco_ctx* ctx, unsigned capacity);
+void pco_gen_add(struct pco_ctx* ctx, struct pco_result_array* arr, void* data);
+struct pco_result pco_gen_span(struct pco_ctx* ctx, const char* str, const char* rest);
+void* pco_gen_slice(struct pco_ctx* ctx, const char* str, const char* rest);
+struct pco_mark pco_gen_mark(struct pco_ctx* ctx);
+void* pco_gen_fold(struct pco_ctx* ctx, pco_fold_f step, void* acc, void* item, struct pco_mark mark);
+void pco_gen_rewind(struct pco_ctx* ctx, struct pco_mark mark);
+void pco_gen_fail(struct pco_ctx* ctx, const char* pos, const struct pco_charset* set);
+void pco_gen_fail_str(struct pco_ctx* ctx, const char* lit, size_t len, const char* str);
+struct pco_result pco_gen_fail_result(const struct pco_ctx* ctx, const char* str);
+void pco_gen_fail_overflow(struct pco_ctx* ctx, const char* pos);
+double pco_gen_float(struct pco_ctx* ctx, const char* str, const char* rest);
+const struct pco_result* pco_gen_memo_find(struct pco_ctx* ctx, const void* key, const char* str);
+void pco_gen_memo_insert(struct pco_ctx* ctx, const void* key, const char* str, struct pco_result result);
+#endif